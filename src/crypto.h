@@ -0,0 +1,43 @@
+/* 
+ * libneosc - an easy access library to the YubiKey NEO(-N)/4 (nano)
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#ifndef _NEOSC_CRYPTO_INCLUDED
+#define _NEOSC_CRYPTO_INCLUDED
+
+#include "libneosc.h"
+
+/* private to the library, shared by the hash and key derivation code */
+
+#define HIDDEN __attribute__((visibility("hidden")))
+
+#define NEOSC_CPU_SHANI	0x01
+#define NEOSC_CPU_AVX2	0x02
+
+extern void neosc_sha1_iterate(NEOSC_SHA1HMDATA *key,unsigned int *u,
+	unsigned int *acc,int iterations) HIDDEN;
+extern void neosc_sha1_iterate_mb(NEOSC_SHA1HMDATA *key,unsigned int *u,
+	unsigned int *acc,int total,int iterations) HIDDEN;
+extern int neosc_sha1_select(int mask) HIDDEN;
+extern void neosc_sha256_iterate(NEOSC_SHA256HMDATA *key,unsigned int *u,
+	unsigned int *acc,int iterations) HIDDEN;
+extern int neosc_sha256_select(int mask) HIDDEN;
+
+#endif
@@ -0,0 +1,63 @@
+/* 
+ * libneosc - an easy access library to the YubiKey NEO(-N)/4 (nano)
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#ifndef _NEOSC_INTERNAL_INCLUDED
+#define _NEOSC_INTERNAL_INCLUDED
+
+#include <pcsclite.h>
+#include <winscard.h>
+#include "libneosc.h"
+#include "crypto.h"
+
+/* private to the library, the PC/SC handle as seen by the applet code */
+
+typedef struct
+{
+	int valid;
+	time_t step;
+	int total;
+	NEOSC_OATH_RESPONSE *data;
+} OATHWIN;
+
+typedef struct
+{
+	SCARDCONTEXT card;
+	SCARDHANDLE handle;
+	int lock;
+	int batch;
+	int batchlock;
+	int batchfail;
+	int batchcnt;
+	int batchstart;
+	int batchseq;
+	int stateok;
+	NEOSC_STATUS state;
+	int oathcache;
+	int oathhits;
+	int oathmisses;
+	int oathidok;
+	unsigned char oathid[8];
+	OATHWIN oathwin[NEOSC_OATH_WINDOWS];
+} CTX;
+
+extern void neosc_oath_cache_free(void *ctx) HIDDEN;
+
+#endif
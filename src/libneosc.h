@@ -38,15 +38,24 @@ extern "C"
 #define NEOSC_APDU_BUFFER	264
 
 #define NEOSC_OATH_NAMELEN	64
+#define NEOSC_OATH_SECRETLEN	64
 #define NEOSC_OATH_STEP		30
+#define NEOSC_OATH_WINDOWS	8
 #define NEOSC_OATH_HOTP		0
 #define NEOSC_OATH_TOTP		1
 #define NEOSC_OATH_SHA1		0
 #define NEOSC_OATH_SHA256	1
+#define NEOSC_OATH_FLAG_TOTP	0x01
+#define NEOSC_OATH_FLAG_HOTP	0x02
+#define NEOSC_OATH_FLAG_SHA256	0x04
+#define NEOSC_OATH_FLAG_TOUCH	0x08
+#define NEOSC_OATH_FLAG_CODE	0x10
 
 #define NEOSC_SHA256_SIZE	32
 #define NEOSC_SHA1_SIZE		20
+#define NEOSC_SHA1_LANES	8
 #define NEOSC_SHA1(a)		unsigned char a[NEOSC_SHA1_SIZE]
+#define NEOSC_SHA256(a)		unsigned char a[NEOSC_SHA256_SIZE]
 
 #define NEOSC_TKT_TAB0		0x01
 #define NEOSC_TKT_TAB1		0x02
@@ -100,6 +109,29 @@ extern "C"
 #define NEOSC_MODE_U2F_CCID	0x05
 #define NEOSC_MODE_OTP_U2F_CCID	0x06
 
+#define NEOSC_JOB_PENDING	1
+#define NEOSC_JOB_DONE		0
+#define NEOSC_JOB_FAILED	-1
+#define NEOSC_JOB_TIMEOUT	-2
+
+#define NEOSC_SLOT_SIZE		58
+#define NEOSC_SLOT_RAW		0
+#define NEOSC_SLOT_SWAP		1
+#define NEOSC_SLOT_UPDATE	2
+#define NEOSC_SLOT_HMAC		3
+#define NEOSC_SLOT_OTP		4
+#define NEOSC_SLOT_HOTP		5
+#define NEOSC_SLOT_YUBIOTP	6
+#define NEOSC_SLOT_PASSWD	7
+
+#define NEOSC_YUBIOTP_REPLAY	-2
+
+#define NEOSC_STORE_KEYLEN	32
+#define NEOSC_STORE_SYNC	0x01
+#define NEOSC_STORE_REPLAY	-2
+
+#define NEOSC_OTP_REPLAY	-2
+
 typedef struct
 {
 	int type;
@@ -173,10 +205,36 @@ typedef struct
 	char name[NEOSC_OATH_NAMELEN+1];
 } NEOSC_OATH_LIST;
 
+typedef struct
+{
+	int total;
+	int size;
+	int nlen;
+	int nsize;
+	int *name;
+	int *digits;
+	int *value;
+	int *flags;
+	char *names;
+} NEOSC_OATH_TABLE;
+
+typedef struct
+{
+	char *name;
+	int otpmode;
+	int shamode;
+	int digits;
+	int touch;
+	unsigned int counter;
+	unsigned char *secret;
+	int slen;
+	int status;
+} NEOSC_OATH_CRED;
+
 typedef struct
 {
 	unsigned int sha1[5];
-	unsigned int total;
+	unsigned long long total;
 	union
 	{
 		unsigned int l[16];
@@ -191,6 +249,98 @@ typedef struct
 	unsigned int osha1[5];
 } NEOSC_SHA1HMDATA;
 
+typedef struct
+{
+	unsigned int sha256[8];
+	unsigned long long total;
+	union
+	{
+		unsigned int l[16];
+		unsigned char b[64];
+	} bfr;
+	unsigned char size;
+} NEOSC_SHA256DATA;
+
+typedef struct
+{
+	unsigned char bfr[4];
+	unsigned char size;
+	unsigned char done;
+} NEOSC_BASE64DATA;
+
+typedef struct
+{
+	unsigned int isha256[8];
+	unsigned int osha256[8];
+} NEOSC_SHA256HMDATA;
+
+typedef struct
+{
+	int shamode;
+	int digits;
+	union
+	{
+		NEOSC_SHA1HMDATA sha1;
+		NEOSC_SHA256HMDATA sha256;
+	} hm;
+} NEOSC_OTP_KEY;
+
+typedef struct
+{
+	int serial;
+	int slot;
+	int ilen;
+	int timeout;
+	int result;
+	unsigned char challenge[64];
+	unsigned char response[NEOSC_SHA1_SIZE];
+} NEOSC_USB_HMAC_JOB;
+
+typedef struct
+{
+	int type;
+	int slot;
+	int command;
+	int tktflags;
+	int cfgflags;
+	int extflags;
+	int omp;
+	int tt;
+	int mui;
+	int imf;
+	int publen;
+	int privlen;
+	int aeslen;
+	int newlen;
+	int codelen;
+	unsigned char *pubid;
+	unsigned char *privid;
+	unsigned char *aesdata;
+	unsigned char *newcode;
+	unsigned char *code;
+} NEOSC_SLOT_CONFIG;
+
+typedef struct
+{
+	int publen;
+	int usectr;
+	int sessctr;
+	unsigned char pubid[16];
+	unsigned char privid[6];
+	unsigned char aeskey[16];
+} NEOSC_YUBIOTP_CRED;
+
+typedef struct
+{
+	int publen;
+	int usectr;
+	int sessctr;
+	int tstamp;
+	int random;
+	unsigned char pubid[16];
+	unsigned char privid[6];
+} NEOSC_YUBIOTP_TOKEN;
+
 extern char *neosc_util_id2uri(int id);
 extern int neosc_util_uri2id(char *uri);
 extern int neosc_util_sha1_to_otp(unsigned char *in,int ilen,int digits,
@@ -201,14 +351,31 @@ extern int neosc_util_modhex_encode(unsigned char *in,int ilen,char *out,
 	int *olen);
 extern int neosc_util_modhex_decode(char *in,int ilen,unsigned char *out,
 	int *olen);
+extern int neosc_util_modhex_verify(char *in,int ilen,int *offset);
+extern int neosc_util_index_build(char *file,NEOSC_YUBIOTP_CRED *cred,
+	int total);
+extern int neosc_util_index_open(char *file,void **index);
+extern int neosc_util_index_reload(void *index);
+extern int neosc_util_index_lookup(void *index,unsigned char *pubid,
+	int publen,NEOSC_YUBIOTP_CRED *cred);
+extern void neosc_util_index_close(void *index);
 extern int neosc_util_hex_encode(unsigned char *in,int ilen,char *out,
 	int *olen);
 extern int neosc_util_hex_decode(char *in,int ilen,unsigned char *out,
 	int *olen);
+extern int neosc_util_hex_verify(char *in,int ilen,int *offset);
 extern int neosc_util_base64_encode(unsigned char *in,int ilen,char *out,
 	int *olen);
 extern int neosc_util_base64_decode(char *in,int ilen,unsigned char *out,
 	int *olen);
+extern void neosc_util_base64_init(NEOSC_BASE64DATA *ptr);
+extern int neosc_util_base64_encode_next(NEOSC_BASE64DATA *ptr,
+	unsigned char *in,int ilen,char *out,int *olen);
+extern int neosc_util_base64_encode_end(NEOSC_BASE64DATA *ptr,char *out,
+	int *olen);
+extern int neosc_util_base64_decode_next(NEOSC_BASE64DATA *ptr,char *in,
+	int ilen,unsigned char *out,int *olen);
+extern int neosc_util_base64_decode_end(NEOSC_BASE64DATA *ptr);
 extern int neosc_util_base32_encode(unsigned char *in,int ilen,char *out,
 	int *olen);
 extern int neosc_util_base32_decode(char *in,int ilen,unsigned char *out,
@@ -216,11 +383,50 @@ extern int neosc_util_base32_decode(char *in,int ilen,unsigned char *out,
 extern int neosc_util_qrurl(char *name,int otpmode,int shamode,int digits,
 	unsigned int counter,unsigned char *secret,int slen,char *out,int olen);
 
+extern int neosc_slot_encode(NEOSC_SLOT_CONFIG *cfg,int *command,
+	unsigned char *out);
+
+extern int neosc_yubiotp_decode(char *otp,int olen,unsigned char *aeskey,
+	NEOSC_YUBIOTP_TOKEN *token);
+extern int neosc_yubiotp_open(void **handle);
+extern int neosc_yubiotp_add(void *handle,NEOSC_YUBIOTP_CRED *cred);
+extern int neosc_yubiotp_verify(void *handle,char *otp,int olen,
+	NEOSC_YUBIOTP_TOKEN *token);
+extern int neosc_yubiotp_store(void *handle,void *store);
+extern void neosc_yubiotp_close(void *handle);
+
+extern int neosc_store_open(char *file,int stripes,int flags,void **store);
+extern int neosc_store_get(void *store,unsigned char *key,int klen,
+	long long *value);
+extern int neosc_store_advance(void *store,unsigned char *key,int klen,
+	long long value);
+extern int neosc_store_snapshot(void *store);
+extern void neosc_store_close(void *store);
+
+extern int neosc_otp_init(NEOSC_OTP_KEY *key,int shamode,int digits,
+	unsigned char *secret,int slen);
+extern void neosc_otp_clear(NEOSC_OTP_KEY *key);
+extern int neosc_otp_hotp(NEOSC_OTP_KEY *key,unsigned long long counter,
+	int *code);
+extern int neosc_otp_totp(NEOSC_OTP_KEY *key,time_t time,int step,int *code);
+extern int neosc_otp_hotp_verify(NEOSC_OTP_KEY *key,unsigned long long counter,
+	int window,int code,unsigned long long *next);
+extern int neosc_otp_hotp_resync(NEOSC_OTP_KEY *key,unsigned long long counter,
+	int window,int code1,int code2,unsigned long long *next);
+extern int neosc_otp_totp_verify(NEOSC_OTP_KEY *key,time_t time,int step,
+	int skew,int code,int *offset);
+extern int neosc_otp_hotp_check(NEOSC_OTP_KEY *key,void *store,
+	unsigned char *id,int idlen,int window,int code);
+extern int neosc_otp_totp_check(NEOSC_OTP_KEY *key,void *store,
+	unsigned char *id,int idlen,time_t time,int step,int skew,int code);
+
 extern int neosc_neo_select(void *ctx,NEOSC_NEO_INFO *info);
 extern int neosc_neo_select_mgr(void *ctx);
 extern int neosc_neo_read_serial(void *ctx,int *serial);
 extern int neosc_neo_read_hmac(void *ctx,int slot,unsigned char *in,int ilen,
 	unsigned char *out,int olen);
+extern int neosc_neo_read_hmac_batch(void *ctx,int slot,unsigned char *in,
+	int ilen,int total,unsigned char *out,int olen);
 extern int neosc_neo_read_otp(void *ctx,int slot,unsigned char *in,int ilen,
 	unsigned char *out,int olen);
 extern int neosc_neo_read_status(void *ctx,NEOSC_STATUS *state);
@@ -262,6 +468,9 @@ extern int neosc_neo_passwd(void *ctx,int slot,unsigned char *pubid,int publen,
 	unsigned char *privid,int privlen,unsigned char *aesdata,int aeslen,
 	int tktflags,int cfgflags,int extflags,unsigned char *newcode,
 	int newlen,unsigned char *code,int codelen);
+extern int neosc_neo_slot(void *ctx,NEOSC_SLOT_CONFIG *cfg);
+extern int neosc_neo_batch_begin(void *ctx);
+extern int neosc_neo_batch_end(void *ctx);
 
 extern int neosc_ndef_select(void *ctx);
 extern int neosc_ndef_read_cc(void *ctx,NEOSC_NDEF_CC *data);
@@ -271,14 +480,31 @@ extern int neosc_oath_select(void *ctx,NEOSC_OATH_INFO *info);
 extern int neosc_oath_reset(void *ctx);
 extern int neosc_oath_unlock(void *ctx,char *password,NEOSC_OATH_INFO *info);
 extern int neosc_oath_chgpass(void *ctx,char *password,NEOSC_OATH_INFO *info);
+extern int neosc_oath_key_cache(int ttl);
+extern int neosc_oath_derive_key(char *password,NEOSC_OATH_INFO *info,
+	unsigned char *key);
+extern int neosc_oath_unlock_key(void *ctx,unsigned char *key,
+	NEOSC_OATH_INFO *info);
 extern int neosc_oath_calc_single(void *ctx,char *name,time_t time,
 	NEOSC_OATH_RESPONSE *result);
 extern int neosc_oath_calc_all(void *ctx,time_t time,
 	NEOSC_OATH_RESPONSE **result,int *total);
 extern int neosc_oath_list_all(void *ctx,NEOSC_OATH_LIST **result,int *total);
+extern int neosc_oath_calc_table(void *ctx,time_t time,
+	NEOSC_OATH_TABLE **table);
+extern int neosc_oath_list_table(void *ctx,NEOSC_OATH_TABLE **table);
+extern int neosc_oath_calc_all_buf(void *ctx,time_t time,
+	NEOSC_OATH_TABLE *table);
+extern int neosc_oath_list_all_buf(void *ctx,NEOSC_OATH_TABLE *table);
+extern int neosc_oath_info_table(void *ctx,time_t time,
+	NEOSC_OATH_TABLE **table);
 extern int neosc_oath_delete(void *ctx,char *name);
 extern int neosc_oath_add(void *ctx,char *name,int otpmode,int shamode,
 	int digits,unsigned int counter,unsigned char *secret,int slen);
+extern int neosc_oath_add_batch(void *ctx,NEOSC_OATH_CRED *cred,int total);
+extern int neosc_oath_cache(void *ctx,int enable);
+extern int neosc_oath_cache_stats(void *ctx,int *hits,int *misses);
+extern int neosc_oath_prefetch(void *ctx,time_t time,int windows);
 
 extern int neosc_pgp_select(void *ctx);
 
@@ -286,6 +512,8 @@ extern int neosc_piv_select(void *ctx);
 
 extern void neosc_pbkdf2(char *pass,unsigned char *salt,int slen,int iterations,
 	unsigned char *out,int olen);
+extern void neosc_pbkdf2_sha256(char *pass,unsigned char *salt,int slen,
+	int iterations,unsigned char *out,int olen);
 
 extern void neosc_sha1init(NEOSC_SHA1DATA *ptr);
 extern void neosc_sha1next(unsigned char *data,unsigned int length,
@@ -301,6 +529,26 @@ extern void neosc_sha1hmend(unsigned char *result,NEOSC_SHA1DATA *ptr,
 	NEOSC_SHA1HMDATA *key);
 extern void neosc_sha1hmac(unsigned char *data,unsigned int length,
 	unsigned char *result,NEOSC_SHA1HMDATA *key);
+extern int neosc_sha1_file(char *file,unsigned char *result);
+extern void neosc_sha1_mb(unsigned char **data,unsigned int length,
+	unsigned char **result,int total);
+extern void neosc_sha1hmac_mb(unsigned char **data,unsigned int length,
+	unsigned char **result,NEOSC_SHA1HMDATA **key,int total);
+
+extern void neosc_sha256init(NEOSC_SHA256DATA *ptr);
+extern void neosc_sha256next(unsigned char *data,unsigned int length,
+	NEOSC_SHA256DATA *ptr);
+extern void neosc_sha256end(unsigned char *result,NEOSC_SHA256DATA *ptr);
+extern void neosc_sha256(unsigned char *data,unsigned int length,
+	unsigned char *result);
+extern void neosc_sha256hmkey(unsigned char *key,unsigned int keylength,
+	NEOSC_SHA256HMDATA *ptr);
+extern void neosc_sha256hminit(NEOSC_SHA256DATA *ptr,NEOSC_SHA256HMDATA *key);
+#define neosc_sha256hmnext(a,b,c) neosc_sha256next(a,b,c)
+extern void neosc_sha256hmend(unsigned char *result,NEOSC_SHA256DATA *ptr,
+	NEOSC_SHA256HMDATA *key);
+extern void neosc_sha256hmac(unsigned char *data,unsigned int length,
+	unsigned char *result,NEOSC_SHA256HMDATA *key);
 
 extern int neosc_pcsc_apdu(void *ctx,unsigned char *in,int ilen,
 	unsigned char *out,int *olen,int *status);
@@ -317,6 +565,7 @@ extern int neosc_usb_read_hmac(void *handle,int slot,unsigned char *in,int ilen,
 	unsigned char *out,int olen);
 extern int neosc_usb_read_otp(void *handle,int slot,unsigned char *in,int ilen,
 	unsigned char *out,int olen);
+extern int neosc_usb_hmac_batch(NEOSC_USB_HMAC_JOB *job,int total);
 extern int neosc_usb_write_ndef(void *handle,int slot,char *url,char *txt,
 	char *lang,unsigned char *code,int codelen);
 extern int neosc_usb_write_scanmap(void *handle,unsigned char *map,int maplen);
@@ -351,6 +600,7 @@ extern int neosc_usb_passwd(void *handle,int slot,unsigned char *pubid,
 	int publen,unsigned char *privid,int privlen,unsigned char *aesdata,
 	int aeslen,int tktflags,int cfgflags,int extflags,
 	unsigned char *newcode,int newlen,unsigned char *code,int codelen);
+extern int neosc_usb_slot(void *handle,NEOSC_SLOT_CONFIG *cfg);
 
 #ifdef __cplusplus
 }
@@ -22,6 +22,7 @@
 #include <string.h>
 #include <unistd.h>
 #include "libneosc.h"
+#include "internal.h"
 
 #define memclear(a,b,c) \
     do { memset(a,b,c); *(volatile char*)(a)=*(volatile char*)(a); } while(0)
@@ -46,21 +47,6 @@ static unsigned char set_config2[]=
 	0x00,0x01,0x03,0x00
 };
 
-static unsigned char upd_config[]=
-{
-	0x00,0x01,0x04,0x00
-};
-
-static unsigned char upd_config2[]=
-{
-	0x00,0x01,0x05,0x00
-};
-
-static unsigned char do_swap[]=
-{
-	0x00,0x01,0x06,0x00
-};
-
 static unsigned char set_ndef[]=
 {
 	0x00,0x01,0x08,0x00
@@ -138,18 +124,83 @@ static unsigned char get_ndef[]=
 	0x00,0x04,0x00,0x00
 };
 
-static unsigned short crc16(unsigned char *ptr,int len)
+static void parse_status(void *ctx,unsigned char *bfr,NEOSC_STATUS *state)
+{
+	CTX *_ctx=ctx;
+
+	_ctx->state.major=bfr[0];
+	_ctx->state.minor=bfr[1];
+	_ctx->state.build=bfr[2];
+	_ctx->state.pgmseq=bfr[3];
+	_ctx->state.touchlevel=bfr[5];
+	_ctx->state.touchlevel<<=8;
+	_ctx->state.touchlevel|=bfr[4];
+	_ctx->state.config1=(_ctx->state.touchlevel&0x01)?1:0;
+	_ctx->state.config2=(_ctx->state.touchlevel&0x02)?1:0;
+	_ctx->state.touch1=(_ctx->state.touchlevel&0x04)?1:0;
+	_ctx->state.touch2=(_ctx->state.touchlevel&0x08)?1:0;
+	_ctx->state.ledinv=(_ctx->state.touchlevel&0x10)?1:0;
+	_ctx->state.touchlevel&=~0x1f;
+	_ctx->stateok=1;
+	if(state)*state=_ctx->state;
+}
+
+/* the cached status is only trusted while the caller holds the card lock */
+
+static int neo_status(void *ctx,NEOSC_STATUS *state)
 {
-	int i;
-	unsigned short crc=0xffff;
+	CTX *_ctx=ctx;
+
+	if(!_ctx->lock||!_ctx->stateok)return neosc_neo_read_status(ctx,state);
+	*state=_ctx->state;
+	return 0;
+}
+
+static int neo_write(void *ctx,unsigned char *bfr,int len,int reset)
+{
+	CTX *_ctx=ctx;
+	int status;
+	int seq;
+	int retry=1;
+	NEOSC_STATUS state;
+	unsigned char resp[NEOSC_APDU_BUFFER];
+	int rlen=sizeof(resp);
+
+	if(_ctx->batch)
+	{
+		if(_ctx->batchfail)return -1;
+		if(neosc_pcsc_apdu(ctx,bfr,len,resp,&rlen,&status)||
+			status!=0x9000)
+		{
+			_ctx->batchfail=1;
+			return -1;
+		}
+		if(rlen==6)parse_status(ctx,resp,NULL);
+		_ctx->batchcnt++;
+		if(reset)_ctx->batchseq=-1;
+		else if(_ctx->batchseq!=-1)
+			_ctx->batchseq=(_ctx->batchseq+1)&0xff;
+		return 0;
+	}
+
+repeat:	if(neo_status(ctx,&state))return -1;
+	seq=state.pgmseq;
 
-	while(len--)
+	rlen=sizeof(resp);
+	if(neosc_pcsc_apdu(ctx,bfr,len,resp,&rlen,&status)||status!=0x9000)
 	{
-		crc^=*ptr++;
-		for(i=0;i<8;i++)if(crc&1)crc=(crc>>1)^0x8408;
-		else crc>>=1;
+		_ctx->stateok=0;
+		return -1;
+	}
+	if(neosc_neo_read_status(ctx,&state))return -1;
+	if(reset&&!state.config1&&!state.config2&&!state.pgmseq)return 0;
+	if(seq!=state.pgmseq)return 0;
+	if(retry--)
+	{
+		usleep(250000);
+		goto repeat;
 	}
-	return crc;
+	return -1;
 }
 
 int neosc_neo_select(void *ctx,NEOSC_NEO_INFO *info)
@@ -163,6 +214,8 @@ int neosc_neo_select(void *ctx,NEOSC_NEO_INFO *info)
 	if(neosc_pcsc_apdu(ctx,sel_neo,sizeof(sel_neo),bfr,&len,&status)||
 		status!=0x9000||len<10)return -1;
 
+	parse_status(ctx,bfr,NULL);
+
 	if(info)
 	{
 		info->major=bfr[0];
@@ -235,6 +288,45 @@ int neosc_neo_read_hmac(void *ctx,int slot,unsigned char *in,int ilen,
 	return r;
 }
 
+int neosc_neo_read_hmac_batch(void *ctx,int slot,unsigned char *in,int ilen,
+	int total,unsigned char *out,int olen)
+{
+	int i;
+	int len;
+	int lock;
+	int r=0;
+	int status;
+	CTX *_ctx=ctx;
+	unsigned char *res=out;
+	unsigned char bfr[sizeof(get_hmac1)+65];
+
+	if(!ctx||!in||ilen<1||ilen>64||slot<0||slot>1||total<1||!out||
+		olen/NEOSC_SHA1_SIZE<total)return -1;
+
+	lock=_ctx->lock?0:1;
+	if(neosc_pcsc_lock(ctx))return -1;
+
+	memcpy(bfr,slot?get_hmac2:get_hmac1,sizeof(get_hmac1));
+	bfr[sizeof(get_hmac1)]=(unsigned char)ilen;
+
+	for(i=0;i<total;i++,in+=ilen,out+=NEOSC_SHA1_SIZE)
+	{
+		memcpy(bfr+sizeof(get_hmac1)+1,in,ilen);
+		len=NEOSC_SHA1_SIZE;
+		if(neosc_pcsc_apdu(ctx,bfr,sizeof(get_hmac1)+ilen+1,out,&len,
+			&status)||status!=0x9000||len!=NEOSC_SHA1_SIZE)
+		{
+			r=-1;
+			break;
+		}
+	}
+
+	if(lock&&neosc_pcsc_unlock(ctx))r=-1;
+	if(r)memclear(res,0,total*NEOSC_SHA1_SIZE);
+	memclear(bfr,0,sizeof(bfr));
+	return r;
+}
+
 int neosc_neo_read_otp(void *ctx,int slot,unsigned char *in,int ilen,
 	unsigned char *out,int olen)
 {
@@ -262,20 +354,12 @@ int neosc_neo_read_status(void *ctx,NEOSC_STATUS *state)
 	if(!ctx||!state)return -1;
 
 	if(neosc_pcsc_apdu(ctx,get_status,sizeof(get_status),bfr,&len,&status)||
-		status!=0x9000||len!=6)return -1;
-	state->major=bfr[0];
-	state->minor=bfr[1];
-	state->build=bfr[2];
-	state->pgmseq=bfr[3];
-	state->touchlevel=bfr[5];
-	state->touchlevel<<=8;
-	state->touchlevel|=bfr[4];
-	state->config1=(state->touchlevel&0x01)?1:0;
-	state->config2=(state->touchlevel&0x02)?1:0;
-	state->touch1=(state->touchlevel&0x04)?1:0;
-	state->touch2=(state->touchlevel&0x08)?1:0;
-	state->ledinv=(state->touchlevel&0x10)?1:0;
-	state->touchlevel&=~0x1f;
+		status!=0x9000||len!=6)
+	{
+		((CTX *)ctx)->stateok=0;
+		return -1;
+	}
+	parse_status(ctx,bfr,state);
 	return 0;
 }
 
@@ -334,13 +418,9 @@ int neosc_neo_read_yubiotp(void *ctx,int slot,char *out,int olen)
 int neosc_neo_write_ndef(void *ctx,int slot,char *url,char *txt,char *lang,
 	unsigned char *code,int codelen)
 {
-	int r=0;
-	int status;
+	int r;
 	int len;
 	int id;
-	int seq;
-	int retry=1;
-	NEOSC_STATUS state;
 	unsigned char bfr[sizeof(set_ndef)+63];
 
 	if(!ctx||(slot^(slot&1)))return -1;
@@ -349,13 +429,6 @@ int neosc_neo_write_ndef(void *ctx,int slot,char *url,char *txt,char *lang,
 	if(txt&&!lang)return -1;
 	if(code&&codelen!=6)return -1;
 
-repeat:	if(neosc_neo_read_status(ctx,&state))
-	{
-		memclear(bfr,0,sizeof(bfr));
-		return -1;
-	}
-	seq=state.pgmseq;
-
 	memcpy(bfr,slot?set_ndef2:set_ndef,sizeof(set_ndef));
 	bfr[sizeof(set_ndef)]=62;
 	memset(bfr+sizeof(set_ndef)+1,0,62);
@@ -383,18 +456,7 @@ repeat:	if(neosc_neo_read_status(ctx,&state))
 	}
 	if(code)memcpy(bfr+sizeof(set_ndef)+57,code,6);
 
-	if(neosc_pcsc_apdu(ctx,bfr,sizeof(bfr),NULL,NULL,&status)||
-		status!=0x9000)r=-1;
-	else if(neosc_neo_read_status(ctx,&state))r=-1;
-	else if(seq==state.pgmseq)
-	{
-		if(retry--)
-		{
-			usleep(250000);
-			goto repeat;
-		}
-		r=-1;
-	}
+	r=neo_write(ctx,bfr,sizeof(bfr),0);
 
 	memclear(bfr,0,sizeof(bfr));
 	return r;
@@ -402,39 +464,17 @@ repeat:	if(neosc_neo_read_status(ctx,&state))
 
 int neosc_neo_write_scanmap(void *ctx,unsigned char *map,int maplen)
 {
-	int r=0;
-	int status;
-	int seq;
-	int retry=1;
-	NEOSC_STATUS state;
+	int r;
 	unsigned char bfr[sizeof(set_scanmap)+46];
 
 	if(!ctx||(map&&maplen!=45))return -1;
 
-repeat:	if(neosc_neo_read_status(ctx,&state))
-	{
-		memclear(bfr,0,sizeof(bfr));
-		return -1;
-	}
-	seq=state.pgmseq;
-
 	memcpy(bfr,set_scanmap,sizeof(set_scanmap));
 	bfr[sizeof(set_scanmap)]=45;
 	if(!map)memset(bfr+sizeof(set_scanmap)+1,0,45);
 	else memcpy(bfr+sizeof(set_scanmap)+1,map,45);
 
-	if(neosc_pcsc_apdu(ctx,bfr,sizeof(bfr),NULL,NULL,&status)||
-		status!=0x9000)r=-1;
-	else if(neosc_neo_read_status(ctx,&state))r=-1;
-	else if(seq==state.pgmseq)
-	{
-		if(retry--)
-		{
-			usleep(250000);
-			goto repeat;
-		}
-		r=-1;
-	}
+	r=neo_write(ctx,bfr,sizeof(bfr),0);
 
 	memclear(bfr,0,sizeof(bfr));
 	return r;
@@ -442,23 +482,12 @@ repeat:	if(neosc_neo_read_status(ctx,&state))
 
 int neosc_neo_setmode(void *ctx,int mode,int crtimeout,int autoejecttime)
 {
-	int r=0;
-	int status;
-	int seq;
-	int retry=1;
-	NEOSC_STATUS state;
+	int r;
 	unsigned char bfr[sizeof(set_mode)+5];
 
 	if(!ctx||(mode&~0x87)||(mode&0x07)==0x07||crtimeout<0||crtimeout>255||
 		autoejecttime<0||autoejecttime>65535)return -1;
 
-repeat:	if(neosc_neo_read_status(ctx,&state))
-	{
-		memclear(bfr,0,sizeof(bfr));
-		return -1;
-	}
-	seq=state.pgmseq;
-
 	memcpy(bfr,set_mode,sizeof(set_mode));
 	bfr[sizeof(set_mode)]=0x04;
 	bfr[sizeof(set_mode)+1]=(unsigned char)mode;
@@ -466,18 +495,7 @@ repeat:	if(neosc_neo_read_status(ctx,&state))
 	bfr[sizeof(set_mode)+3]=(unsigned char)autoejecttime;
 	bfr[sizeof(set_mode)+4]=(unsigned char)(autoejecttime>>8);
 
-	if(neosc_pcsc_apdu(ctx,bfr,sizeof(bfr),NULL,NULL,&status)||
-		status!=0x9000)r=-1;
-	else if(neosc_neo_read_status(ctx,&state))r=-1;
-	else if(seq==state.pgmseq)
-	{
-		if(retry--)
-		{
-			usleep(250000);
-			goto repeat;
-		}
-		r=-1;
-	}
+	r=neo_write(ctx,bfr,sizeof(bfr),0);
 
 	memclear(bfr,0,sizeof(bfr));
 	return r;
@@ -487,40 +505,20 @@ int neosc_neo_setmode_mgr(void *ctx,int mode,int crtimeout,int autoejecttime)
 {
 	int r=0;
 	int status;
-	int seq;
-	int retry=1;
-	NEOSC_STATUS state;
-	unsigned char bfr[sizeof(set_mode)+5];
+	unsigned char bfr[sizeof(set_mode_mgr)+5];
 
 	if(!ctx||(mode&~0x87)||(mode&0x07)==0x07||crtimeout<0||crtimeout>255||
 		autoejecttime<0||autoejecttime>65535)return -1;
 
-repeat:	if(neosc_neo_read_status(ctx,&state))
-	{
-		memclear(bfr,0,sizeof(bfr));
-		return -1;
-	}
-	seq=state.pgmseq;
-
-	memcpy(bfr,set_mode,sizeof(set_mode_mgr));
-	bfr[sizeof(set_mode)]=0x04;
-	bfr[sizeof(set_mode)+1]=(unsigned char)mode;
-	bfr[sizeof(set_mode)+2]=(unsigned char)crtimeout;
-	bfr[sizeof(set_mode)+3]=(unsigned char)autoejecttime;
-	bfr[sizeof(set_mode)+4]=(unsigned char)(autoejecttime>>8);
+	memcpy(bfr,set_mode_mgr,sizeof(set_mode_mgr));
+	bfr[sizeof(set_mode_mgr)]=0x04;
+	bfr[sizeof(set_mode_mgr)+1]=(unsigned char)mode;
+	bfr[sizeof(set_mode_mgr)+2]=(unsigned char)crtimeout;
+	bfr[sizeof(set_mode_mgr)+3]=(unsigned char)autoejecttime;
+	bfr[sizeof(set_mode_mgr)+4]=(unsigned char)(autoejecttime>>8);
 
 	if(neosc_pcsc_apdu(ctx,bfr,sizeof(bfr),NULL,NULL,&status)||
 		status!=0x9000)r=-1;
-	else if(neosc_neo_read_status(ctx,&state))r=-1;
-	else if(seq==state.pgmseq)
-	{
-		if(retry--)
-		{
-			usleep(250000);
-			goto repeat;
-		}
-		r=-1;
-	}
 
 	memclear(bfr,0,sizeof(bfr));
 	return r;
@@ -528,128 +526,126 @@ repeat:	if(neosc_neo_read_status(ctx,&state))
 
 int neosc_neo_reset(void *ctx,int slot)
 {
-	int r=0;
-	int status;
-	int seq;
-	int retry=1;
-	NEOSC_STATUS state;
 	unsigned char bfr[sizeof(set_config)+59];
 
 	if(!ctx||(slot^(slot&1)))return -1;
 
-repeat:	if(neosc_neo_read_status(ctx,&state))return -1;
-	seq=state.pgmseq;
-
 	memcpy(bfr,slot?set_config2:set_config,sizeof(set_config));
 	bfr[sizeof(set_config)]=58;
 	memset(bfr+sizeof(set_config)+1,0,58);
 
-	if(neosc_pcsc_apdu(ctx,bfr,sizeof(bfr),NULL,NULL,&status)||
-		status!=0x9000)r=-1;
-	else if(neosc_neo_read_status(ctx,&state))r=-1;
-	else if(!state.config1&&!state.config2&&!state.pgmseq);
-	else if(seq==state.pgmseq)
-	{
-		if(retry--)
-		{
-			usleep(250000);
-			goto repeat;
-		}
-		r=-1;
-	}
-
-	return r;
+	return neo_write(ctx,bfr,sizeof(bfr),1);
 }
 
-int neosc_neo_config(void *ctx,unsigned char *apdu4,int tktflags,int cfgflags,
-	int extflags,unsigned char *fixeddata,int fixedlen,
-	unsigned char *uidpart,int uidlen,unsigned char *aesdata,int aeslen,
-	unsigned char *newcode,int newlen,unsigned char *code,int codelen)
+static int neo_slot(void *ctx,unsigned char *apdu4,NEOSC_SLOT_CONFIG *cfg)
 {
-	unsigned short crc;
-	int r=0;
-	int status;
-	int seq;
-	int retry=1;
-	NEOSC_STATUS state;
-	unsigned char bfr[63];
+	int r;
+	int command;
+	unsigned char bfr[NEOSC_SLOT_SIZE+5];
 
-	if(!ctx||!apdu4)return -1;
-	if(code&&codelen!=6)return -1;
-	if(newcode&&newlen!=6)return -1;
-	if(fixeddata)if(fixedlen<0||fixedlen>16)return -1;
-	if(uidpart&&uidlen!=4&&uidlen!=6)return -1;
-	if(aesdata&&aeslen!=16)return -1;
+	if(!ctx)return -1;
+	if(neosc_slot_encode(cfg,&command,bfr+5))return -1;
 
-repeat:	if(neosc_neo_read_status(ctx,&state))
+	if(apdu4)memcpy(bfr,apdu4,4);
+	else
 	{
-		memclear(bfr,0,sizeof(bfr));
-		return -1;
+		bfr[0]=0x00;
+		bfr[1]=0x01;
+		bfr[2]=(unsigned char)command;
+		bfr[3]=0x00;
 	}
-	seq=state.pgmseq;
-
-	memcpy(bfr,apdu4,4);
-	bfr[4]=58;
-	memset(bfr+5,0,58);
-
-	if(uidpart)memcpy(bfr+21,uidpart,uidlen);
-	if(aesdata)memcpy(bfr+27,aesdata,16);
-	if(newcode)memcpy(bfr+43,newcode,6);
-	bfr[50]=(unsigned char)extflags;
-	bfr[51]=(unsigned char)tktflags;
-	bfr[52]=(unsigned char)cfgflags;
-	crc=~crc16(bfr+5,50);
-	bfr[55]=(unsigned char)crc;
-	bfr[56]=(unsigned char)(crc>>8);
-	if(code)memcpy(bfr+57,code,6);
+	bfr[4]=NEOSC_SLOT_SIZE;
 
-	if(neosc_pcsc_apdu(ctx,bfr,sizeof(bfr),NULL,NULL,&status)||
-		status!=0x9000)r=-1;
-	else if(neosc_neo_read_status(ctx,&state))r=-1;
-	else if(seq==state.pgmseq)
-	{
-		if(retry--)
-		{
-			usleep(250000);
-			goto repeat;
-		}
-		r=-1;
-	}
+	r=neo_write(ctx,bfr,sizeof(bfr),0);
 
 	memclear(bfr,0,sizeof(bfr));
 	return r;
 }
 
+int neosc_neo_slot(void *ctx,NEOSC_SLOT_CONFIG *cfg)
+{
+	return neo_slot(ctx,NULL,cfg);
+}
+
+int neosc_neo_config(void *ctx,unsigned char *apdu4,int tktflags,int cfgflags,
+	int extflags,unsigned char *fixeddata,int fixedlen,
+	unsigned char *uidpart,int uidlen,unsigned char *aesdata,int aeslen,
+	unsigned char *newcode,int newlen,unsigned char *code,int codelen)
+{
+	NEOSC_SLOT_CONFIG cfg;
+
+	if(!apdu4)return -1;
+
+	memset(&cfg,0,sizeof(cfg));
+	cfg.type=NEOSC_SLOT_RAW;
+	cfg.command=apdu4[2];
+	cfg.tktflags=tktflags;
+	cfg.cfgflags=cfgflags;
+	cfg.extflags=extflags;
+	cfg.pubid=fixeddata;
+	cfg.publen=fixedlen;
+	cfg.privid=uidpart;
+	cfg.privlen=uidlen;
+	cfg.aesdata=aesdata;
+	cfg.aeslen=aeslen;
+	cfg.newcode=newcode;
+	cfg.newlen=newlen;
+	cfg.code=code;
+	cfg.codelen=codelen;
+	return neo_slot(ctx,apdu4,&cfg);
+}
+
 int neosc_neo_swap(void *ctx,unsigned char *newcode,int newlen,
 	unsigned char *code,int codelen)
 {
-	return neosc_neo_config(ctx,do_swap,0,0,0,NULL,0,NULL,0,NULL,0,
-		newcode,newlen,code,codelen);
+	NEOSC_SLOT_CONFIG cfg;
+
+	memset(&cfg,0,sizeof(cfg));
+	cfg.type=NEOSC_SLOT_SWAP;
+	cfg.newcode=newcode;
+	cfg.newlen=newlen;
+	cfg.code=code;
+	cfg.codelen=codelen;
+	return neosc_neo_slot(ctx,&cfg);
 }
 
 int neosc_neo_update(void *ctx,int slot,int tktflags,int cfgflags,int extflags,
 	unsigned char *newcode,int newlen,unsigned char *code,int codelen)
 {
-	if(slot^(slot&1))return -1;
-	if((tktflags&~0x3f)||(cfgflags&~0x0c)||(extflags&~0xff))return -1;
-	if((extflags&0x60)==0x40)return -1;
-
-	return neosc_neo_config(ctx,slot?upd_config2:upd_config,tktflags,
-		cfgflags,extflags,NULL,0,NULL,0,NULL,0,newcode,newlen,code,
-		codelen);
+	NEOSC_SLOT_CONFIG cfg;
+
+	memset(&cfg,0,sizeof(cfg));
+	cfg.type=NEOSC_SLOT_UPDATE;
+	cfg.slot=slot;
+	cfg.tktflags=tktflags;
+	cfg.cfgflags=cfgflags;
+	cfg.extflags=extflags;
+	cfg.newcode=newcode;
+	cfg.newlen=newlen;
+	cfg.code=code;
+	cfg.codelen=codelen;
+	return neosc_neo_slot(ctx,&cfg);
 }
 
 int neosc_neo_hmac(void *ctx,int slot,unsigned char *aesdata,int aeslen,
 	int tktflags,int cfgflags,int extflags,unsigned char *newcode,
 	int newlen,unsigned char *code,int codelen)
 {
-	if((slot^(slot&1))||!aesdata||aeslen!=20||(tktflags&~0x80)||
-		(cfgflags&~0x0c)||(extflags&~0xff))return -1;
-	if((extflags&0x60)==0x40)return -1;
-
-	return neosc_neo_config(ctx,slot?set_config2:set_config,tktflags|0x40,
-		cfgflags|0x22,extflags,NULL,0,aesdata+16,4,aesdata,16,
-		newcode,newlen,code,codelen);
+	NEOSC_SLOT_CONFIG cfg;
+
+	memset(&cfg,0,sizeof(cfg));
+	cfg.type=NEOSC_SLOT_HMAC;
+	cfg.slot=slot;
+	cfg.aesdata=aesdata;
+	cfg.aeslen=aeslen;
+	cfg.tktflags=tktflags;
+	cfg.cfgflags=cfgflags;
+	cfg.extflags=extflags;
+	cfg.newcode=newcode;
+	cfg.newlen=newlen;
+	cfg.code=code;
+	cfg.codelen=codelen;
+	return neosc_neo_slot(ctx,&cfg);
 }
 
 int neosc_neo_otp(void *ctx,int slot,unsigned char *privid,int privlen,
@@ -657,14 +653,23 @@ int neosc_neo_otp(void *ctx,int slot,unsigned char *privid,int privlen,
 	int extflags,unsigned char *newcode,int newlen,unsigned char *code,
 	int codelen)
 {
-	if((slot^(slot&1))||!aesdata||aeslen!=16||(tktflags&~0x80)||
-		(cfgflags&~0x08)||(extflags&~0xff))return -1;
-	if((extflags&0x60)==0x40)return -1;
-	if(privid&&privlen!=6)return -1;
-
-	return neosc_neo_config(ctx,slot?set_config2:set_config,tktflags|0x40,
-		cfgflags|0x20,extflags,NULL,0,privid,6,aesdata,16,
-		newcode,newlen,code,codelen);
+	NEOSC_SLOT_CONFIG cfg;
+
+	memset(&cfg,0,sizeof(cfg));
+	cfg.type=NEOSC_SLOT_OTP;
+	cfg.slot=slot;
+	cfg.privid=privid;
+	cfg.privlen=privlen;
+	cfg.aesdata=aesdata;
+	cfg.aeslen=aeslen;
+	cfg.tktflags=tktflags;
+	cfg.cfgflags=cfgflags;
+	cfg.extflags=extflags;
+	cfg.newcode=newcode;
+	cfg.newlen=newlen;
+	cfg.code=code;
+	cfg.codelen=codelen;
+	return neosc_neo_slot(ctx,&cfg);
 }
 
 int neosc_neo_hotp(void *ctx,int slot,int omp,int tt,int mui,int imf,
@@ -672,46 +677,25 @@ int neosc_neo_hotp(void *ctx,int slot,int omp,int tt,int mui,int imf,
 	int extflags,unsigned char *newcode,int newlen,unsigned char *code,
 	int codelen)
 {
-	int r;
-	int fixedlen=0;
-	unsigned char uidpart[6];
-	unsigned char fixeddata[6];
-
-	if((slot^(slot&1))||!aesdata||aeslen!=20||(tktflags&~0xbf)||
-		(cfgflags&~0x5f)||(extflags&~0xff))return -1;
-	if((extflags&0x60)==0x40)return -1;
-	if(omp<0||omp>255||tt<0||tt>255||mui<-1||mui>99999999)return -1;
-	if(imf<0||imf>0xffff0||(imf&0xf))return -1;
-
-	if(mui>=0)
-	{
-		fixedlen=6;
-		fixeddata[0]=(unsigned char)omp;
-		fixeddata[1]=(unsigned char)tt;
-		fixeddata[2]=(unsigned char)
-				(((mui/10000000)<<4)|((mui/1000000)%10));
-		fixeddata[3]=(unsigned char)
-				((((mui/100000)%10)<<4)|((mui/10000)%10));
-		fixeddata[4]=(unsigned char)
-				((((mui/1000)%10)<<4)|((mui/100)%10));
-		fixeddata[5]=(unsigned char)((((mui/10)%10)<<4)|(mui%10));
-	}
-	else if(cfgflags&0x50)return -1;
-
-	uidpart[0]=aesdata[16];
-	uidpart[1]=aesdata[17];
-	uidpart[2]=aesdata[18];
-	uidpart[3]=aesdata[19];
-	uidpart[4]=(unsigned char)(imf>>12);
-	uidpart[5]=(unsigned char)(imf>>4);
-
-	r=neosc_neo_config(ctx,slot?set_config2:set_config,tktflags|0x40,
-		cfgflags,extflags,fixedlen?fixeddata:NULL,fixedlen,uidpart,6,
-		aesdata,16,newcode,newlen,code,codelen);
-
-	memclear(uidpart,0,6);
-	memclear(fixeddata,0,6);
-	return r;
+	NEOSC_SLOT_CONFIG cfg;
+
+	memset(&cfg,0,sizeof(cfg));
+	cfg.type=NEOSC_SLOT_HOTP;
+	cfg.slot=slot;
+	cfg.omp=omp;
+	cfg.tt=tt;
+	cfg.mui=mui;
+	cfg.imf=imf;
+	cfg.aesdata=aesdata;
+	cfg.aeslen=aeslen;
+	cfg.tktflags=tktflags;
+	cfg.cfgflags=cfgflags;
+	cfg.extflags=extflags;
+	cfg.newcode=newcode;
+	cfg.newlen=newlen;
+	cfg.code=code;
+	cfg.codelen=codelen;
+	return neosc_neo_slot(ctx,&cfg);
 }
 
 int neosc_neo_yubiotp(void *ctx,int slot,unsigned char *pubid,int publen,
@@ -719,14 +703,25 @@ int neosc_neo_yubiotp(void *ctx,int slot,unsigned char *pubid,int publen,
 	int tktflags,int cfgflags,int extflags,unsigned char *newcode,
 	int newlen,unsigned char *code,int codelen)
 {
-	if((slot^(slot&1))||!aesdata||aeslen!=16||(tktflags&~0xbf)||
-		(cfgflags&~0x0d)||(extflags&~0xff))return -1;
-	if((extflags&0x60)==0x40)return -1;
-	if(privid&&privlen!=6)return -1;
-
-	return neosc_neo_config(ctx,slot?set_config2:set_config,tktflags,
-		cfgflags,extflags,pubid,publen,privid,privlen,aesdata,16,
-		newcode,newlen,code,codelen);
+	NEOSC_SLOT_CONFIG cfg;
+
+	memset(&cfg,0,sizeof(cfg));
+	cfg.type=NEOSC_SLOT_YUBIOTP;
+	cfg.slot=slot;
+	cfg.pubid=pubid;
+	cfg.publen=publen;
+	cfg.privid=privid;
+	cfg.privlen=privlen;
+	cfg.aesdata=aesdata;
+	cfg.aeslen=aeslen;
+	cfg.tktflags=tktflags;
+	cfg.cfgflags=cfgflags;
+	cfg.extflags=extflags;
+	cfg.newcode=newcode;
+	cfg.newlen=newlen;
+	cfg.code=code;
+	cfg.codelen=codelen;
+	return neosc_neo_slot(ctx,&cfg);
 }
 
 int neosc_neo_passwd(void *ctx,int slot,unsigned char *pubid,int publen,
@@ -734,15 +729,78 @@ int neosc_neo_passwd(void *ctx,int slot,unsigned char *pubid,int publen,
 	int tktflags,int cfgflags,int extflags,unsigned char *newcode,
 	int newlen,unsigned char *code,int codelen)
 {
-	if((slot^(slot&1))||!aesdata||aeslen!=16||(tktflags&~0xbf)||
-		(cfgflags&~0xdf)||(extflags&~0xff))return -1;
-	if((extflags&0x60)==0x40)return -1;
-	if(!privid||privlen!=6)return -1;
-	if(pubid&&publen<=0)return -1;
-	if((cfgflags&0x02)&&pubid)return -1;
-	if((cfgflags&0x41)==0x01)return -1;
-
-	return neosc_neo_config(ctx,slot?set_config2:set_config,tktflags,
-		cfgflags|0x20,extflags,pubid,publen,privid,privlen,aesdata,16,
-		newcode,newlen,code,codelen);
+	NEOSC_SLOT_CONFIG cfg;
+
+	memset(&cfg,0,sizeof(cfg));
+	cfg.type=NEOSC_SLOT_PASSWD;
+	cfg.slot=slot;
+	cfg.pubid=pubid;
+	cfg.publen=publen;
+	cfg.privid=privid;
+	cfg.privlen=privlen;
+	cfg.aesdata=aesdata;
+	cfg.aeslen=aeslen;
+	cfg.tktflags=tktflags;
+	cfg.cfgflags=cfgflags;
+	cfg.extflags=extflags;
+	cfg.newcode=newcode;
+	cfg.newlen=newlen;
+	cfg.code=code;
+	cfg.codelen=codelen;
+	return neosc_neo_slot(ctx,&cfg);
+}
+
+int neosc_neo_batch_begin(void *ctx)
+{
+	CTX *_ctx=ctx;
+	NEOSC_STATUS state;
+
+	if(!ctx||_ctx->batch)return -1;
+
+	_ctx->batchlock=_ctx->lock?0:1;
+	if(neosc_pcsc_lock(ctx))return -1;
+	if(neo_status(ctx,&state))
+	{
+		if(_ctx->batchlock)neosc_pcsc_unlock(ctx);
+		return -1;
+	}
+	_ctx->batchstart=_ctx->batchseq=state.pgmseq;
+	_ctx->batchcnt=0;
+	_ctx->batchfail=0;
+	_ctx->batch=1;
+	return 0;
+}
+
+int neosc_neo_batch_end(void *ctx)
+{
+	CTX *_ctx=ctx;
+	int r;
+	int retry=1;
+	NEOSC_STATUS state;
+
+	if(!ctx||!_ctx->batch)return -1;
+
+	_ctx->batch=0;
+	r=_ctx->batchfail?-1:0;
+
+	if(!r&&_ctx->batchcnt)
+	{
+repeat:		if(neosc_neo_read_status(ctx,&state))r=-1;
+		else if(_ctx->batchseq==-1)
+		{
+			if(state.pgmseq==_ctx->batchstart&&(state.config1||
+				state.config2||state.pgmseq))r=-1;
+		}
+		else if(state.pgmseq!=_ctx->batchseq)r=-1;
+
+		if(r&&retry--)
+		{
+			r=0;
+			usleep(250000);
+			goto repeat;
+		}
+	}
+
+	if(_ctx->batchlock)if(neosc_pcsc_unlock(ctx))r=-1;
+	return r;
 }
@@ -21,7 +21,11 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
 #include "libneosc.h"
+#include "internal.h"
 
 #define memclear(a,b,c) \
     do { memset(a,b,c); *(volatile char*)(a)=*(volatile char*)(a); } while(0)
@@ -76,8 +80,147 @@ static unsigned char reset_cmd[]=
 	0x00,0x04,0xde,0xad
 };
 
+#define MODE_CALC	0
+#define MODE_LIST	1
+
+#define KEYSLOTS	16
+
+typedef struct
+{
+	int mode;
+	int total;
+	int alloc;
+	int nlen;
+	int nalloc;
+	int pending;
+	int carry;
+	int cur[4];
+	int *col;
+	char *names;
+	NEOSC_OATH_TABLE *out;
+	unsigned char wrk[NEOSC_APDU_BUFFER+258];
+} PARSER;
+
+typedef struct
+{
+	time_t expire;
+	unsigned char identity[8];
+	unsigned char pwhash[NEOSC_SHA1_SIZE];
+	unsigned char key[16];
+} OATHKEY;
+
+typedef struct
+{
+	int ttl;
+	NEOSC_SHA1HMDATA hmdata;
+	OATHKEY slot[KEYSLOTS];
+} KEYCACHE;
+
+static pthread_mutex_t keymtx=PTHREAD_MUTEX_INITIALIZER;
+static KEYCACHE *keycache=NULL;
+
+static void *secure_alloc(size_t len)
+{
+	void *mem;
+
+	if((mem=mmap(NULL,len,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,
+		-1,0))==MAP_FAILED)return NULL;
+	mlock(mem,len);
+#ifdef MADV_DONTDUMP
+	madvise(mem,len,MADV_DONTDUMP);
+#endif
+	return mem;
+}
+
+static void secure_free(void *mem,size_t len)
+{
+	memclear(mem,0,len);
+	munlock(mem,len);
+	munmap(mem,len);
+}
+
+static void cache_clear(OATHWIN *win)
+{
+	if(win->data)secure_free(win->data,
+		win->total*sizeof(NEOSC_OATH_RESPONSE));
+	win->data=NULL;
+	win->total=0;
+	win->valid=0;
+}
+
+static void cache_drop(CTX *ctx)
+{
+	int i;
+
+	for(i=0;i<NEOSC_OATH_WINDOWS;i++)cache_clear(&ctx->oathwin[i]);
+}
+
+static OATHWIN *cache_find(CTX *ctx,time_t step)
+{
+	int i;
+
+	if(!ctx->oathcache)return NULL;
+	for(i=0;i<NEOSC_OATH_WINDOWS;i++)
+		if(ctx->oathwin[i].valid&&ctx->oathwin[i].step==step)
+			return &ctx->oathwin[i];
+	ctx->oathmisses++;
+	return NULL;
+}
+
+static int cache_get(CTX *ctx,time_t step,NEOSC_OATH_RESPONSE **result,
+	int *total)
+{
+	OATHWIN *win;
+
+	if(!(win=cache_find(ctx,step)))return -1;
+	if(!win->total)*result=NULL;
+	else if(!(*result=malloc(win->total*sizeof(NEOSC_OATH_RESPONSE))))
+		return -1;
+	else memcpy(*result,win->data,win->total*sizeof(NEOSC_OATH_RESPONSE));
+	*total=win->total;
+	ctx->oathhits++;
+	return 0;
+}
+
+static void cache_put(CTX *ctx,time_t step,NEOSC_OATH_RESPONSE *data,int total)
+{
+	int i;
+	OATHWIN *win=&ctx->oathwin[0];
+
+	if(!ctx->oathcache||!ctx->oathidok)return;
+
+	for(i=0;i<NEOSC_OATH_WINDOWS;i++)
+	{
+		if(ctx->oathwin[i].valid&&ctx->oathwin[i].step==step)
+		{
+			win=&ctx->oathwin[i];
+			break;
+		}
+		if(!ctx->oathwin[i].valid)win=&ctx->oathwin[i];
+		else if(win->valid&&ctx->oathwin[i].step<win->step)
+			win=&ctx->oathwin[i];
+	}
+
+	cache_clear(win);
+	if(total)
+	{
+		if(!(win->data=secure_alloc(total*sizeof(NEOSC_OATH_RESPONSE))))
+			return;
+		memcpy(win->data,data,total*sizeof(NEOSC_OATH_RESPONSE));
+	}
+	win->step=step;
+	win->total=total;
+	win->valid=1;
+}
+
+void neosc_oath_cache_free(void *ctx)
+{
+	cache_drop(ctx);
+}
+
 int neosc_oath_select(void *ctx,NEOSC_OATH_INFO *info)
 {
+	CTX *_ctx=ctx;
 	int status;
 	unsigned char bfr[28];
 	int len=sizeof(bfr);
@@ -95,6 +238,12 @@ int neosc_oath_select(void *ctx,NEOSC_OATH_INFO *info)
 		break;
 	default:return -1;
 	}
+	if(!_ctx->oathidok||memcmp(_ctx->oathid,bfr+7,8))
+	{
+		cache_drop(_ctx);
+		memcpy(_ctx->oathid,bfr+7,8);
+		_ctx->oathidok=1;
+	}
 	if(info)
 	{
 		info->major=bfr[2];
@@ -119,26 +268,157 @@ int neosc_oath_reset(void *ctx)
 {
 	int status;
 
+	if(!ctx)return -1;
+	cache_drop(ctx);
+	((CTX *)ctx)->oathidok=0;
+
 	if(neosc_pcsc_apdu(ctx,reset_cmd,sizeof(reset_cmd),NULL,NULL,&status)||
 		status!=0x9000)return -1;
 	return 0;
 }
 
-int neosc_oath_unlock(void *ctx,char *password,NEOSC_OATH_INFO *info)
+static time_t key_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec;
+}
+
+static int key_get(char *password,unsigned char *identity,unsigned char *key)
+{
+	int i;
+	int r=-1;
+	time_t now;
+	unsigned char pwhash[NEOSC_SHA1_SIZE];
+
+	pthread_mutex_lock(&keymtx);
+	if(!keycache)goto out;
+
+	now=key_now();
+	neosc_sha1hmac((unsigned char *)password,strlen(password),pwhash,
+		&keycache->hmdata);
+	for(i=0;i<KEYSLOTS;i++)if(keycache->slot[i].expire>now&&
+		!memcmp(keycache->slot[i].identity,identity,8)&&
+		!memcmp(keycache->slot[i].pwhash,pwhash,NEOSC_SHA1_SIZE))
+	{
+		memcpy(key,keycache->slot[i].key,16);
+		r=0;
+		break;
+	}
+	memclear(pwhash,0,sizeof(pwhash));
+
+out:	pthread_mutex_unlock(&keymtx);
+	return r;
+}
+
+static void key_put(char *password,unsigned char *identity,unsigned char *key,
+	int exclusive)
+{
+	int i;
+	time_t now;
+	OATHKEY *k=NULL;
+	unsigned char pwhash[NEOSC_SHA1_SIZE];
+
+	pthread_mutex_lock(&keymtx);
+	if(!keycache)goto out;
+
+	now=key_now();
+	neosc_sha1hmac((unsigned char *)password,strlen(password),pwhash,
+		&keycache->hmdata);
+	for(i=0;i<KEYSLOTS;i++)
+	{
+		if(keycache->slot[i].expire<=now)
+			memclear(&keycache->slot[i],0,sizeof(OATHKEY));
+		else if(!memcmp(keycache->slot[i].identity,identity,8))
+		{
+			if(!memcmp(keycache->slot[i].pwhash,pwhash,
+				NEOSC_SHA1_SIZE))k=&keycache->slot[i];
+			else if(exclusive)memclear(&keycache->slot[i],0,
+				sizeof(OATHKEY));
+		}
+	}
+	if(!k)for(k=&keycache->slot[0],i=1;i<KEYSLOTS;i++)
+		if(keycache->slot[i].expire<k->expire)k=&keycache->slot[i];
+
+	k->expire=now+keycache->ttl;
+	memcpy(k->identity,identity,8);
+	memcpy(k->pwhash,pwhash,NEOSC_SHA1_SIZE);
+	memcpy(k->key,key,16);
+	memclear(pwhash,0,sizeof(pwhash));
+
+out:	pthread_mutex_unlock(&keymtx);
+}
+
+static void key_drop(unsigned char *identity)
+{
+	int i;
+
+	pthread_mutex_lock(&keymtx);
+	if(keycache)for(i=0;i<KEYSLOTS;i++)
+		if(!memcmp(keycache->slot[i].identity,identity,8))
+			memclear(&keycache->slot[i],0,sizeof(OATHKEY));
+	pthread_mutex_unlock(&keymtx);
+}
+
+static void key_derive(char *password,unsigned char *identity,
+	unsigned char *key)
+{
+	if(!key_get(password,identity,key))return;
+	neosc_pbkdf2(password,identity,8,1000,key,16);
+	key_put(password,identity,key,0);
+}
+
+int neosc_oath_key_cache(int ttl)
+{
+	int r=0;
+	unsigned char secret[NEOSC_SHA1_SIZE];
+
+	if(ttl<0)return -1;
+
+	pthread_mutex_lock(&keymtx);
+	if(!ttl)
+	{
+		if(keycache)secure_free(keycache,sizeof(KEYCACHE));
+		keycache=NULL;
+	}
+	else if(keycache)keycache->ttl=ttl;
+	else if(neosc_util_random(secret,sizeof(secret)))r=-1;
+	else if(!(keycache=secure_alloc(sizeof(KEYCACHE))))r=-1;
+	else
+	{
+		keycache->ttl=ttl;
+		neosc_sha1hmkey(secret,sizeof(secret),&keycache->hmdata);
+	}
+	pthread_mutex_unlock(&keymtx);
+
+	memclear(secret,0,sizeof(secret));
+	return r;
+}
+
+int neosc_oath_derive_key(char *password,NEOSC_OATH_INFO *info,
+	unsigned char *key)
+{
+	if(!password||!info||!key)return -1;
+
+	key_derive(password,info->identity,key);
+	return 0;
+}
+
+int neosc_oath_unlock_key(void *ctx,unsigned char *key,NEOSC_OATH_INFO *info)
 {
 	int status;
 	NEOSC_SHA1HMDATA hmdata;
 	unsigned char bfr[sizeof(unlock_cmd)+NEOSC_SHA1_SIZE+10];
 
-	if(!ctx||!password||!info)return -1;
+	if(!ctx||!key||!info)return -1;
 
 	if(!info->protected)return 0;
 
 	if(neosc_util_random(bfr+sizeof(unlock_cmd)+NEOSC_SHA1_SIZE+2,8))
 		return -1;
 	memcpy(bfr,unlock_cmd,sizeof(unlock_cmd));
-	neosc_pbkdf2(password,info->identity,8,1000,bfr+sizeof(unlock_cmd),16);
-	neosc_sha1hmkey(bfr+sizeof(unlock_cmd),16,&hmdata);
+	neosc_sha1hmkey(key,16,&hmdata);
 	neosc_sha1hmac(info->challenge,8,bfr+sizeof(unlock_cmd),&hmdata);
 	memclear(&hmdata,0,sizeof(hmdata));
 	bfr[sizeof(unlock_cmd)+NEOSC_SHA1_SIZE]=0x74;
@@ -153,6 +433,21 @@ int neosc_oath_unlock(void *ctx,char *password,NEOSC_OATH_INFO *info)
 	return 0;
 }
 
+int neosc_oath_unlock(void *ctx,char *password,NEOSC_OATH_INFO *info)
+{
+	int r;
+	unsigned char key[16];
+
+	if(!ctx||!password||!info)return -1;
+
+	if(!info->protected)return 0;
+
+	key_derive(password,info->identity,key);
+	r=neosc_oath_unlock_key(ctx,key,info);
+	memclear(key,0,sizeof(key));
+	return r;
+}
+
 int neosc_oath_chgpass(void *ctx,char *password,NEOSC_OATH_INFO *info)
 {
 	int status;
@@ -167,6 +462,7 @@ int neosc_oath_chgpass(void *ctx,char *password,NEOSC_OATH_INFO *info)
 		memcpy(bfr+sizeof(chgpass_cmd),"\x02\x73\x00",3);
 		if(neosc_pcsc_apdu(ctx,bfr,sizeof(chgpass_cmd)+3,NULL,NULL,
 			&status)||status!=0x9000)return -1;
+		if(info)key_drop(info->identity);
 		return 0;
 	}
 
@@ -179,8 +475,7 @@ int neosc_oath_chgpass(void *ctx,char *password,NEOSC_OATH_INFO *info)
 	bfr[sizeof(chgpass_cmd)+21]=0x08;
 	bfr[sizeof(chgpass_cmd)+30]=0x75;
 	bfr[sizeof(chgpass_cmd)+31]=NEOSC_SHA1_SIZE;
-	neosc_pbkdf2(password,info->identity,8,1000,
-		bfr+sizeof(chgpass_cmd)+4,16);
+	key_derive(password,info->identity,bfr+sizeof(chgpass_cmd)+4);
 	neosc_sha1hmkey(bfr+sizeof(chgpass_cmd)+4,16,&hmdata);
 	neosc_sha1hmac(bfr+sizeof(chgpass_cmd)+22,8,
 		bfr+sizeof(chgpass_cmd)+32,&hmdata);
@@ -191,6 +486,7 @@ int neosc_oath_chgpass(void *ctx,char *password,NEOSC_OATH_INFO *info)
 		memclear(bfr,0,sizeof(bfr));
 		return -1;
 	}
+	key_put(password,info->identity,bfr+sizeof(chgpass_cmd)+4,1);
 	memclear(bfr,0,sizeof(bfr));
 	return 0;
 }
@@ -198,6 +494,8 @@ int neosc_oath_chgpass(void *ctx,char *password,NEOSC_OATH_INFO *info)
 int neosc_oath_calc_single(void *ctx,char *name,time_t time,
 	NEOSC_OATH_RESPONSE *result)
 {
+	CTX *_ctx=ctx;
+	OATHWIN *win;
 	int status;
 	int nlen;
 	unsigned char bfr[sizeof(single_cmd)+NEOSC_OATH_NAMELEN+13];
@@ -207,6 +505,18 @@ int neosc_oath_calc_single(void *ctx,char *name,time_t time,
 	nlen=strlen(name);
 	if(nlen<0||nlen>NEOSC_OATH_NAMELEN)return -1;
 
+	if((win=cache_find(ctx,time/NEOSC_OATH_STEP)))
+	{
+		for(status=0;status<win->total;status++)
+			if(!strcmp(win->data[status].name,name))
+		{
+			*result=win->data[status];
+			_ctx->oathhits++;
+			return 0;
+		}
+		_ctx->oathmisses++;
+	}
+
 	memcpy(bfr,single_cmd,sizeof(single_cmd));
 	bfr[sizeof(single_cmd)]=nlen+12;
 	bfr[sizeof(single_cmd)+1]=0x71;
@@ -242,175 +552,467 @@ int neosc_oath_calc_single(void *ctx,char *name,time_t time,
 	return 0;
 }
 
-int neosc_oath_calc_all(void *ctx,time_t time,NEOSC_OATH_RESPONSE **result,
-	int *total)
+static int parse_name(PARSER *p,unsigned char *name,int nlen)
 {
-	int status;
-	unsigned char bfr[4096];
-	int len=sizeof(bfr);
-	int olen=0;
-	int pos=0;
-	int curr=0;
-	int alloc=0;
-	NEOSC_OATH_RESPONSE *data=NULL;
-	NEOSC_OATH_RESPONSE *tmp;
+	char *names;
 
-	if(!ctx||!total||!result)return -1;
+	p->cur[0]=p->nlen;
+	p->cur[1]=0;
+	p->cur[2]=0;
+	p->cur[3]=0;
 
-	memcpy(bfr,all_cmd,sizeof(all_cmd));
-	neosc_util_time_to_array(time,bfr+sizeof(all_cmd),8);
+	if(p->out)
+	{
+		if(p->nlen+nlen+1<=p->out->nsize)
+		{
+			memcpy(p->out->names+p->nlen,name,nlen);
+			p->out->names[p->nlen+nlen]=0;
+		}
+		p->nlen+=nlen+1;
+		return 0;
+	}
 
-	if(neosc_pcsc_apdu(ctx,bfr,sizeof(all_cmd)+8,bfr,&len,&status))
-		return -1;
-	while((status&0xff00)==0x6100)
+	if(p->nlen+nlen+1>p->nalloc)
 	{
-		olen+=len;
-		len=sizeof(bfr)-olen;
-		if(neosc_pcsc_apdu(ctx,next_cmd,sizeof(next_cmd),bfr+olen,&len,
-			&status))return -1;
+		while(p->nlen+nlen+1>p->nalloc)
+			p->nalloc=p->nalloc?p->nalloc<<1:1024;
+		if(!(names=realloc(p->names,p->nalloc)))return -1;
+		p->names=names;
 	}
-	if(status!=0x9000)return -1;
-	olen+=len;
+	memcpy(p->names+p->nlen,name,nlen);
+	p->names[p->nlen+nlen]=0;
+	p->nlen+=nlen+1;
+	return 0;
+}
 
-	while(pos<olen)
+static int parse_commit(PARSER *p)
+{
+	int *col;
+
+	if(p->out)
 	{
-		if(curr==alloc)
+		if(p->total<p->out->size&&p->nlen<=p->out->nsize)
 		{
-			alloc+=16;
-			if(!(tmp=realloc(data,
-				alloc*sizeof(NEOSC_OATH_RESPONSE))))goto fail;
-			data=tmp;
+			p->out->name[p->total]=p->cur[0];
+			p->out->digits[p->total]=p->cur[1];
+			p->out->value[p->total]=p->cur[2];
+			p->out->flags[p->total]=p->cur[3];
 		}
+		p->total++;
+		return 0;
+	}
+
+	if(p->total==p->alloc)
+	{
+		p->alloc=p->alloc?p->alloc<<1:16;
+		if(!(col=realloc(p->col,p->alloc*4*sizeof(int))))return -1;
+		p->col=col;
+	}
+	memcpy(p->col+(p->total<<2),p->cur,sizeof(p->cur));
+	p->total++;
+	return 0;
+}
+
+static int parse_tlv(PARSER *p,unsigned char *tlv)
+{
+	switch(tlv[0])
+	{
+	case 0x71:
+		if(p->mode!=MODE_CALC||p->pending||tlv[1]>NEOSC_OATH_NAMELEN)
+			return -1;
+		if(parse_name(p,tlv+2,tlv[1]))return -1;
+		p->pending=1;
+		return 0;
 
-		if(pos+2>=olen||bfr[pos++]!=0x71)goto fail;
-		len=bfr[pos++];
-		if(len>NEOSC_OATH_NAMELEN||pos+len>=olen)goto fail;
-		memcpy(data[curr].name,bfr+pos,len);
-		data[curr].name[len]=0;
-		pos+=len;
-		switch(bfr[pos++])
+	case 0x72:
+		if(p->mode!=MODE_LIST||tlv[1]<1||tlv[1]-1>NEOSC_OATH_NAMELEN)
+			return -1;
+		if(parse_name(p,tlv+3,tlv[1]-1))return -1;
+		switch(tlv[2]&0xf0)
 		{
-		case 0x77:
-			if(pos>=olen||pos+bfr[pos]+1>olen)goto fail;
-			pos+=bfr[pos]+1;
+		case 0x10:
+			p->cur[3]=NEOSC_OATH_FLAG_HOTP;
 			break;
-
-		case 0x76:
-			if(pos>=olen||bfr[pos]!=0x05||pos+bfr[pos]+1>olen)
-				goto fail;
-			data[curr].digits=bfr[pos+1];
-			data[curr].value=bfr[pos+2];
-			data[curr].value<<=8;
-			data[curr].value|=bfr[pos+3];
-			data[curr].value<<=8;
-			data[curr].value|=bfr[pos+4];
-			data[curr].value<<=8;
-			data[curr].value|=bfr[pos+5];
-			switch(bfr[pos+1])
-			{
-			case 6:	data[curr].value%=1000000;
-				break;
-			case 7:	data[curr].value%=10000000;
-				break;
-			case 8:	data[curr].value%=100000000;
-				break;
-			default:return -1;
-			}
-			pos+=bfr[pos]+1;
-			curr++;
+		case 0x20:
+			p->cur[3]=NEOSC_OATH_FLAG_TOTP;
+			break;
+		default:return -1;
+		}
+		switch(tlv[2]&0x0f)
+		{
+		case 0x01:
 			break;
+		case 0x02:
+			p->cur[3]|=NEOSC_OATH_FLAG_SHA256;
+			break;
+		default:return -1;
+		}
+		return parse_commit(p);
+	}
+
+	if(p->mode!=MODE_CALC||!p->pending)return -1;
+	p->pending=0;
 
+	switch(tlv[0])
+	{
+	case 0x76:
+		if(tlv[1]!=0x05)return -1;
+		p->cur[1]=tlv[2];
+		p->cur[2]=((tlv[3]<<24)|(tlv[4]<<16)|(tlv[5]<<8)|tlv[6])&
+			0x7fffffff;
+		switch(tlv[2])
+		{
+		case 6:	p->cur[2]%=1000000;
+			break;
+		case 7:	p->cur[2]%=10000000;
+			break;
+		case 8:	p->cur[2]%=100000000;
+			break;
 		default:return -1;
 		}
+		p->cur[3]=NEOSC_OATH_FLAG_TOTP|NEOSC_OATH_FLAG_CODE;
+		break;
+
+	case 0x77:
+		p->cur[1]=tlv[1]?tlv[2]:0;
+		p->cur[3]=NEOSC_OATH_FLAG_HOTP;
+		break;
+
+	case 0x7c:
+		p->cur[1]=tlv[1]?tlv[2]:0;
+		p->cur[3]=NEOSC_OATH_FLAG_TOTP|NEOSC_OATH_FLAG_TOUCH;
+		break;
+
+	default:return -1;
 	}
 
-	if(alloc>curr)if((tmp=realloc(data,curr*sizeof(NEOSC_OATH_RESPONSE))))
-		data=tmp;
+	return parse_commit(p);
+}
 
-	*result=data;
-	*total=curr;
+static int parse_feed(PARSER *p,unsigned char *data,int len)
+{
+	int pos;
+
+	memcpy(p->wrk+p->carry,data,len);
+	len+=p->carry;
 
+	for(pos=0;pos+2<=len&&pos+2+p->wrk[pos+1]<=len;pos+=2+p->wrk[pos+1])
+		if(parse_tlv(p,p->wrk+pos))return -1;
+
+	p->carry=len-pos;
+	memmove(p->wrk,p->wrk+pos,p->carry);
 	return 0;
+}
 
-fail:	if(data)free(data);
-	return -1;
+static void parse_free(PARSER *p)
+{
+	if(p->col)
+	{
+		memclear(p->col,0,p->alloc*4*sizeof(int));
+		free(p->col);
+	}
+	if(p->names)
+	{
+		memclear(p->names,0,p->nalloc);
+		free(p->names);
+	}
+	memclear(p->wrk,0,sizeof(p->wrk));
 }
 
-int neosc_oath_list_all(void *ctx,NEOSC_OATH_LIST **result,int *total)
+static int parse_run(void *ctx,unsigned char *cmd,int clen,PARSER *p)
 {
+	int r=-1;
+	int len=NEOSC_APDU_BUFFER;
 	int status;
-	unsigned char bfr[4096];
-	int len=sizeof(bfr);
-	int olen=0;
-	int pos=0;
-	int curr=0;
-	int alloc=0;
-	NEOSC_OATH_LIST *data=NULL;
-	NEOSC_OATH_LIST *tmp;
+	unsigned char bfr[NEOSC_APDU_BUFFER];
 
-	if(!ctx||!total||!result)return -1;
+	if(neosc_pcsc_apdu(ctx,cmd,clen,bfr,&len,&status))goto out;
+	while(1)
+	{
+		if(parse_feed(p,bfr,len))goto out;
+		if((status&0xff00)!=0x6100)break;
+		len=NEOSC_APDU_BUFFER;
+		if(neosc_pcsc_apdu(ctx,next_cmd,sizeof(next_cmd),bfr,&len,
+			&status))goto out;
+	}
+	if(status==0x9000&&!p->carry&&!p->pending)r=0;
+
+out:	memclear(bfr,0,sizeof(bfr));
+	return r;
+}
+
+static int parse_table(void *ctx,unsigned char *cmd,int clen,int mode,
+	NEOSC_OATH_TABLE **table)
+{
+	int i;
+	PARSER p;
+	NEOSC_OATH_TABLE *t;
+
+	memset(&p,0,sizeof(p));
+	p.mode=mode;
+
+	if(parse_run(ctx,cmd,clen,&p))goto fail;
+
+	if(!(t=malloc(sizeof(NEOSC_OATH_TABLE)+p.total*4*sizeof(int)+p.nlen)))
+		goto fail;
+	t->total=t->size=p.total;
+	t->nlen=t->nsize=p.nlen;
+	t->name=(int *)(t+1);
+	t->digits=t->name+p.total;
+	t->value=t->digits+p.total;
+	t->flags=t->value+p.total;
+	t->names=(char *)(t->flags+p.total);
+	for(i=0;i<p.total;i++)
+	{
+		t->name[i]=p.col[i<<2];
+		t->digits[i]=p.col[(i<<2)+1];
+		t->value[i]=p.col[(i<<2)+2];
+		t->flags[i]=p.col[(i<<2)+3];
+	}
+	if(p.nlen)memcpy(t->names,p.names,p.nlen);
+
+	parse_free(&p);
+	*table=t;
+	return 0;
+
+fail:	parse_free(&p);
+	return -1;
+}
 
-	if(neosc_pcsc_apdu(ctx,list_cmd,sizeof(list_cmd),bfr,&len,&status))
+static int parse_buf(void *ctx,unsigned char *cmd,int clen,int mode,
+	NEOSC_OATH_TABLE *table)
+{
+	int r=-1;
+	PARSER p;
+
+	memset(&p,0,sizeof(p));
+	p.mode=mode;
+	p.out=table;
+
+	if(!parse_run(ctx,cmd,clen,&p))
+	{
+		r=(p.total>table->size||p.nlen>table->nsize)?1:0;
+		table->total=p.total;
+		table->nlen=p.nlen;
+	}
+
+	parse_free(&p);
+	return r;
+}
+
+static int calc_all(void *ctx,time_t time,NEOSC_OATH_RESPONSE **result,
+	int *total)
+{
+	int i;
+	int curr;
+	NEOSC_OATH_TABLE *t;
+	NEOSC_OATH_RESPONSE *data=NULL;
+
+	if(neosc_oath_calc_table(ctx,time,&t))return -1;
+
+	for(curr=0,i=0;i<t->total;i++)
+		if(t->flags[i]&NEOSC_OATH_FLAG_CODE)curr++;
+	if(curr&&!(data=malloc(curr*sizeof(NEOSC_OATH_RESPONSE))))
+	{
+		free(t);
 		return -1;
-	while((status&0xff00)==0x6100)
+	}
+	for(curr=0,i=0;i<t->total;i++)if(t->flags[i]&NEOSC_OATH_FLAG_CODE)
 	{
-		olen+=len;
-		len=sizeof(bfr)-olen;
-		if(neosc_pcsc_apdu(ctx,next_cmd,sizeof(next_cmd),bfr+olen,&len,
-			&status))return -1;
+		data[curr].digits=t->digits[i];
+		data[curr].value=t->value[i];
+		strcpy(data[curr].name,t->names+t->name[i]);
+		curr++;
 	}
-	if(status!=0x9000)return -1;
-	olen+=len;
+	free(t);
+
+	cache_put(ctx,time/NEOSC_OATH_STEP,data,curr);
+
+	*result=data;
+	*total=curr;
+	return 0;
+}
 
-	while(pos<olen)
+int neosc_oath_calc_table(void *ctx,time_t time,NEOSC_OATH_TABLE **table)
+{
+	unsigned char bfr[sizeof(all_cmd)+8];
+
+	if(!ctx||!table)return -1;
+
+	memcpy(bfr,all_cmd,sizeof(all_cmd));
+	neosc_util_time_to_array(time,bfr+sizeof(all_cmd),8);
+
+	return parse_table(ctx,bfr,sizeof(bfr),MODE_CALC,table);
+}
+
+int neosc_oath_list_table(void *ctx,NEOSC_OATH_TABLE **table)
+{
+	if(!ctx||!table)return -1;
+
+	return parse_table(ctx,list_cmd,sizeof(list_cmd),MODE_LIST,table);
+}
+
+static unsigned int name_hash(char *name)
+{
+	unsigned int h=0x811c9dc5;
+
+	while(*name)h=(h^(unsigned char)*name++)*0x01000193;
+	return h;
+}
+
+int neosc_oath_info_table(void *ctx,time_t time,NEOSC_OATH_TABLE **table)
+{
+	int i;
+	int r=-1;
+	int lock;
+	unsigned int j;
+	unsigned int mask;
+	int *hash=NULL;
+	CTX *_ctx=ctx;
+	NEOSC_OATH_TABLE *list=NULL;
+	NEOSC_OATH_TABLE *calc=NULL;
+
+	if(!ctx||!table)return -1;
+
+	lock=_ctx->lock?0:1;
+	if(neosc_pcsc_lock(ctx))return -1;
+
+	if(neosc_oath_list_table(ctx,&list))goto out;
+	if(neosc_oath_calc_table(ctx,time,&calc))goto out;
+
+	for(mask=16;mask<(unsigned int)list->total*2;mask<<=1);
+	if(!(hash=malloc(mask*sizeof(int))))goto out;
+	memset(hash,0xff,mask*sizeof(int));
+	mask--;
+
+	for(i=0;i<list->total;i++)
 	{
-		if(curr==alloc)
-		{
-			alloc+=16;
-			if(!(tmp=realloc(data,
-				alloc*sizeof(NEOSC_OATH_LIST))))goto fail;
-			data=tmp;
-		}
+		for(j=name_hash(list->names+list->name[i])&mask;hash[j]!=-1;
+			j=(j+1)&mask);
+		hash[j]=i;
+	}
+
+	for(i=0;i<calc->total;i++)
+	{
+		for(j=name_hash(calc->names+calc->name[i])&mask;hash[j]!=-1;
+			j=(j+1)&mask)if(!strcmp(list->names+list->name[hash[j]],
+				calc->names+calc->name[i]))break;
+		if(hash[j]==-1)continue;
+		list->digits[hash[j]]=calc->digits[i];
+		list->value[hash[j]]=calc->value[i];
+		list->flags[hash[j]]|=calc->flags[i]&
+			(NEOSC_OATH_FLAG_TOUCH|NEOSC_OATH_FLAG_CODE);
+	}
+
+	r=0;
+
+out:	if(lock&&neosc_pcsc_unlock(ctx))r=-1;
+	if(hash)free(hash);
+	if(calc)
+	{
+		memclear(calc,0,sizeof(NEOSC_OATH_TABLE)+calc->total*4*sizeof(int)+
+			calc->nlen);
+		free(calc);
+	}
+	if(!r)*table=list;
+	else if(list)free(list);
+	return r;
+}
+
+int neosc_oath_calc_all_buf(void *ctx,time_t time,NEOSC_OATH_TABLE *table)
+{
+	unsigned char bfr[sizeof(all_cmd)+8];
+
+	if(!ctx||!table||table->size<0||table->nsize<0||
+		(table->size&&(!table->name||!table->digits||!table->value||
+		!table->flags))||(table->nsize&&!table->names))return -1;
+
+	memcpy(bfr,all_cmd,sizeof(all_cmd));
+	neosc_util_time_to_array(time,bfr+sizeof(all_cmd),8);
+
+	return parse_buf(ctx,bfr,sizeof(bfr),MODE_CALC,table);
+}
+
+int neosc_oath_list_all_buf(void *ctx,NEOSC_OATH_TABLE *table)
+{
+	if(!ctx||!table||table->size<0||table->nsize<0||
+		(table->size&&(!table->name||!table->digits||!table->value||
+		!table->flags))||(table->nsize&&!table->names))return -1;
+
+	return parse_buf(ctx,list_cmd,sizeof(list_cmd),MODE_LIST,table);
+}
+
+int neosc_oath_calc_all(void *ctx,time_t time,NEOSC_OATH_RESPONSE **result,
+	int *total)
+{
+	if(!ctx||!total||!result)return -1;
+
+	if(!cache_get(ctx,time/NEOSC_OATH_STEP,result,total))return 0;
+
+	return calc_all(ctx,time,result,total);
+}
+
+int neosc_oath_prefetch(void *ctx,time_t time,int windows)
+{
+	int i;
+	int r=0;
+	int lock;
+	int total;
+	CTX *_ctx=ctx;
+	NEOSC_OATH_RESPONSE *data;
+
+	if(!ctx||windows<0||windows>=NEOSC_OATH_WINDOWS)return -1;
+	if(!_ctx->oathcache||!_ctx->oathidok)return -1;
 
-		if(pos+2>=olen||bfr[pos++]!=0x72)goto fail;
-		len=bfr[pos++];
-		if(len-1>NEOSC_OATH_NAMELEN||pos+len>olen)goto fail;
-		switch(bfr[pos++])
+	lock=_ctx->lock?0:1;
+	if(neosc_pcsc_lock(ctx))return -1;
+
+	for(i=0;i<=windows;i++,time+=NEOSC_OATH_STEP)
+	{
+		if(calc_all(ctx,time,&data,&total))
 		{
-		case 0x11:
-			data[curr].otpmode=NEOSC_OATH_HOTP;
-			data[curr].shamode=NEOSC_OATH_SHA1;
-			break;
-		case 0x12:
-			data[curr].otpmode=NEOSC_OATH_HOTP;
-			data[curr].shamode=NEOSC_OATH_SHA256;
+			r=-1;
 			break;
-		case 0x21:
-			data[curr].otpmode=NEOSC_OATH_TOTP;
-			data[curr].shamode=NEOSC_OATH_SHA1;
-			break;
-		case 0x22:
-			data[curr].otpmode=NEOSC_OATH_TOTP;
-			data[curr].shamode=NEOSC_OATH_SHA256;
-			break;
-		default:goto fail;
 		}
-		memcpy(data[curr].name,bfr+pos,len-1);
-		data[curr].name[len-1]=0;
-		pos+=len-1;
-		curr++;
+		if(data)
+		{
+			memclear(data,0,total*sizeof(NEOSC_OATH_RESPONSE));
+			free(data);
+		}
 	}
 
-	if(alloc>curr)if((tmp=realloc(data,curr*sizeof(NEOSC_OATH_RESPONSE))))
-		data=tmp;
+	if(lock&&neosc_pcsc_unlock(ctx))r=-1;
+	return r;
+}
 
-	*result=data;
-	*total=curr;
+int neosc_oath_list_all(void *ctx,NEOSC_OATH_LIST **result,int *total)
+{
+	int i;
+	NEOSC_OATH_TABLE *t;
+	NEOSC_OATH_LIST *data=NULL;
 
-	return 0;
+	if(!ctx||!total||!result)return -1;
 
-fail:	if(data)free(data);
-	return -1;
+	if(neosc_oath_list_table(ctx,&t))return -1;
+
+	if(t->total&&!(data=malloc(t->total*sizeof(NEOSC_OATH_LIST))))
+	{
+		free(t);
+		return -1;
+	}
+	for(i=0;i<t->total;i++)
+	{
+		data[i].otpmode=(t->flags[i]&NEOSC_OATH_FLAG_TOTP)?
+			NEOSC_OATH_TOTP:NEOSC_OATH_HOTP;
+		data[i].shamode=(t->flags[i]&NEOSC_OATH_FLAG_SHA256)?
+			NEOSC_OATH_SHA256:NEOSC_OATH_SHA1;
+		strcpy(data[i].name,t->names+t->name[i]);
+	}
+
+	*result=data;
+	*total=t->total;
+	free(t);
+	return 0;
 }
 
 int neosc_oath_delete(void *ctx,char *name)
@@ -421,6 +1023,8 @@ int neosc_oath_delete(void *ctx,char *name)
 
 	if(!ctx||!name||!*name||(len=strlen(name))>NEOSC_OATH_NAMELEN)return -1;
 
+	cache_drop(ctx);
+
 	memcpy(bfr,delete_cmd,sizeof(delete_cmd));
 	bfr[sizeof(delete_cmd)]=len+2;
 	bfr[sizeof(delete_cmd)+1]=0x71;
@@ -431,40 +1035,77 @@ int neosc_oath_delete(void *ctx,char *name)
 	return 0;
 }
 
-int neosc_oath_add(void *ctx,char *name,int otpmode,int shamode,int digits,
-	unsigned int counter,unsigned char *secret,int slen)
+static int add_encode(NEOSC_OATH_CRED *cred,unsigned char *bfr)
 {
-	int status;
 	int len;
-	unsigned char bfr[sizeof(add_cmd)+NEOSC_OATH_NAMELEN+33];
+	int slen;
+
+	if(!cred->name||!*cred->name||
+		(len=strlen(cred->name))>NEOSC_OATH_NAMELEN||
+		(cred->otpmode^(cred->otpmode&1))||
+		(cred->shamode^(cred->shamode&1))||cred->digits<6||
+		cred->digits>8||(cred->touch^(cred->touch&1))||!cred->secret||
+		cred->slen<1||cred->slen>NEOSC_OATH_SECRETLEN)return -1;
 
-	if(!ctx||!name||!*name||(len=strlen(name))>NEOSC_OATH_NAMELEN||
-		(otpmode^(otpmode&1))||(shamode^(shamode&1))||digits<6||
-		digits>8||!secret||slen!=
-			(shamode?NEOSC_SHA256_SIZE:NEOSC_SHA1_SIZE))return -1;
+	slen=cred->slen<14?14:cred->slen;
 
 	memcpy(bfr,add_cmd,sizeof(add_cmd));
-	bfr[sizeof(add_cmd)]=len+26+(counter?6:0);
-	bfr[sizeof(add_cmd)+1]=0x71;
-	bfr[sizeof(add_cmd)+2]=len;
-	memcpy(bfr+sizeof(add_cmd)+3,name,len);
-	bfr[sizeof(add_cmd)+len+3]=0x73;
-	bfr[sizeof(add_cmd)+len+4]=0x16;
-	bfr[sizeof(add_cmd)+len+5]=(otpmode?0x21:0x11)+shamode;
-	bfr[sizeof(add_cmd)+len+6]=digits;
-	memcpy(bfr+sizeof(add_cmd)+len+7,secret,NEOSC_SHA1_SIZE);
-	len+=27;
-	if(counter)
-	{
-		bfr[sizeof(add_cmd)+len]=0x7a;
-		bfr[sizeof(add_cmd)+len+1]=0x04;
-		bfr[sizeof(add_cmd)+len+2]=(unsigned char)(counter>>24);
-		bfr[sizeof(add_cmd)+len+3]=(unsigned char)(counter>>16);
-		bfr[sizeof(add_cmd)+len+4]=(unsigned char)(counter>>8);
-		bfr[sizeof(add_cmd)+len+5]=(unsigned char)counter;
+	bfr+=sizeof(add_cmd);
+	bfr[1]=0x71;
+	bfr[2]=len;
+	memcpy(bfr+3,cred->name,len);
+	bfr[len+3]=0x73;
+	bfr[len+4]=slen+2;
+	bfr[len+5]=(cred->otpmode?0x21:0x11)+cred->shamode;
+	bfr[len+6]=cred->digits;
+	memcpy(bfr+len+7,cred->secret,cred->slen);
+	memset(bfr+len+7+cred->slen,0,slen-cred->slen);
+	len+=slen+7;
+	if(cred->touch)
+	{
+		bfr[len]=0x78;
+		bfr[len+1]=0x02;
+		len+=2;
+	}
+	if(cred->counter)
+	{
+		bfr[len]=0x7a;
+		bfr[len+1]=0x04;
+		bfr[len+2]=(unsigned char)(cred->counter>>24);
+		bfr[len+3]=(unsigned char)(cred->counter>>16);
+		bfr[len+4]=(unsigned char)(cred->counter>>8);
+		bfr[len+5]=(unsigned char)cred->counter;
 		len+=6;
 	}
-	if(neosc_pcsc_apdu(ctx,bfr,sizeof(add_cmd)+len,NULL,NULL,&status)||
+	bfr[0]=len-1;
+	return sizeof(add_cmd)+len;
+}
+
+int neosc_oath_add(void *ctx,char *name,int otpmode,int shamode,int digits,
+	unsigned int counter,unsigned char *secret,int slen)
+{
+	int status;
+	int len;
+	NEOSC_OATH_CRED cred;
+	unsigned char bfr[sizeof(add_cmd)+1+NEOSC_OATH_NAMELEN+
+		NEOSC_OATH_SECRETLEN+14];
+
+	if(!ctx||slen!=(shamode?NEOSC_SHA256_SIZE:NEOSC_SHA1_SIZE))return -1;
+
+	cred.name=name;
+	cred.otpmode=otpmode;
+	cred.shamode=shamode;
+	cred.digits=digits;
+	cred.touch=0;
+	cred.counter=counter;
+	cred.secret=secret;
+	cred.slen=slen;
+
+	if((len=add_encode(&cred,bfr))==-1)return -1;
+
+	cache_drop(ctx);
+
+	if(neosc_pcsc_apdu(ctx,bfr,len,NULL,NULL,&status)||
 		status!=0x9000)
 	{
 		memclear(bfr,0,sizeof(bfr));
@@ -473,3 +1114,69 @@ int neosc_oath_add(void *ctx,char *name,int otpmode,int shamode,int digits,
 	memclear(bfr,0,sizeof(bfr));
 	return 0;
 }
+
+int neosc_oath_add_batch(void *ctx,NEOSC_OATH_CRED *cred,int total)
+{
+	int i;
+	int r=0;
+	int len;
+	int lock;
+	CTX *_ctx=ctx;
+	unsigned char bfr[sizeof(add_cmd)+1+NEOSC_OATH_NAMELEN+
+		NEOSC_OATH_SECRETLEN+14];
+
+	if(!ctx||!cred||total<0)return -1;
+
+	for(i=0;i<total;i++)cred[i].status=-1;
+	if(!total)return 0;
+
+	lock=_ctx->lock?0:1;
+	if(neosc_pcsc_lock(ctx))return -1;
+
+	cache_drop(ctx);
+
+	for(i=0;i<total;i++)
+	{
+		if((len=add_encode(&cred[i],bfr))==-1)
+		{
+			r=1;
+			continue;
+		}
+		if(neosc_pcsc_apdu(ctx,bfr,len,NULL,NULL,
+			&cred[i].status))
+		{
+			cred[i].status=-1;
+			r=-1;
+			break;
+		}
+		if(cred[i].status!=0x9000)r=1;
+	}
+	memclear(bfr,0,sizeof(bfr));
+
+	if(lock&&neosc_pcsc_unlock(ctx))r=-1;
+	return r;
+}
+
+int neosc_oath_cache(void *ctx,int enable)
+{
+	CTX *_ctx=ctx;
+
+	if(!ctx||(enable^(enable&1)))return -1;
+
+	if(!enable)cache_drop(_ctx);
+	_ctx->oathcache=enable;
+	_ctx->oathhits=0;
+	_ctx->oathmisses=0;
+	return 0;
+}
+
+int neosc_oath_cache_stats(void *ctx,int *hits,int *misses)
+{
+	CTX *_ctx=ctx;
+
+	if(!ctx)return -1;
+
+	if(hits)*hits=_ctx->oathhits;
+	if(misses)*misses=_ctx->oathmisses;
+	return 0;
+}
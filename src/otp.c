@@ -0,0 +1,259 @@
+/* 
+ * libneosc - an easy access library to the YubiKey NEO(-N)/4 (nano)
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include "libneosc.h"
+
+#define memclear(a,b,c) \
+    do { memset(a,b,c); *(volatile char*)(a)=*(volatile char*)(a); } while(0)
+
+static unsigned int modulus[3]=
+{
+	1000000,10000000,100000000
+};
+
+static void encode(unsigned long long counter,unsigned char *bfr)
+{
+	bfr[0]=(unsigned char)(counter>>56);
+	bfr[1]=(unsigned char)(counter>>48);
+	bfr[2]=(unsigned char)(counter>>40);
+	bfr[3]=(unsigned char)(counter>>32);
+	bfr[4]=(unsigned char)(counter>>24);
+	bfr[5]=(unsigned char)(counter>>16);
+	bfr[6]=(unsigned char)(counter>>8);
+	bfr[7]=(unsigned char)counter;
+}
+
+static int dyntrunc(unsigned char *hash,int hlen,int digits)
+{
+	int idx;
+	unsigned int num;
+
+	idx=hash[hlen-1]&0xf;
+	num=((hash[idx]&0x7f)<<24)|(hash[idx+1]<<16)|(hash[idx+2]<<8)|
+		hash[idx+3];
+	return num%modulus[digits-6];
+}
+
+static int hotp(NEOSC_OTP_KEY *key,unsigned long long counter)
+{
+	int code;
+	unsigned char bfr[8];
+	unsigned char hash[NEOSC_SHA256_SIZE];
+
+	encode(counter,bfr);
+	if(key->shamode==NEOSC_OATH_SHA256)
+	{
+		neosc_sha256hmac(bfr,8,hash,&key->hm.sha256);
+		code=dyntrunc(hash,NEOSC_SHA256_SIZE,key->digits);
+	}
+	else
+	{
+		neosc_sha1hmac(bfr,8,hash,&key->hm.sha1);
+		code=dyntrunc(hash,NEOSC_SHA1_SIZE,key->digits);
+	}
+	memclear(hash,0,sizeof(hash));
+	return code;
+}
+
+static void hotp_mb(NEOSC_OTP_KEY *key,unsigned long long counter,int *code)
+{
+	int i;
+	unsigned char *in[NEOSC_SHA1_LANES];
+	unsigned char *out[NEOSC_SHA1_LANES];
+	NEOSC_SHA1HMDATA *hm[NEOSC_SHA1_LANES];
+	unsigned char bfr[NEOSC_SHA1_LANES][8];
+	unsigned char hash[NEOSC_SHA1_LANES][NEOSC_SHA1_SIZE];
+
+	if(key->shamode==NEOSC_OATH_SHA256)
+	{
+		for(i=0;i<NEOSC_SHA1_LANES;i++)code[i]=hotp(key,counter+i);
+		return;
+	}
+
+	for(i=0;i<NEOSC_SHA1_LANES;i++)
+	{
+		encode(counter+i,bfr[i]);
+		in[i]=bfr[i];
+		out[i]=hash[i];
+		hm[i]=&key->hm.sha1;
+	}
+	neosc_sha1hmac_mb(in,8,out,hm,NEOSC_SHA1_LANES);
+	for(i=0;i<NEOSC_SHA1_LANES;i++)
+		code[i]=dyntrunc(hash[i],NEOSC_SHA1_SIZE,key->digits);
+	memclear(hash,0,sizeof(hash));
+}
+
+int neosc_otp_init(NEOSC_OTP_KEY *key,int shamode,int digits,
+	unsigned char *secret,int slen)
+{
+	if(!key||(shamode^(shamode&1))||digits<6||digits>8||!secret||
+		slen<1)return -1;
+
+	key->shamode=shamode;
+	key->digits=digits;
+	if(shamode==NEOSC_OATH_SHA256)
+		neosc_sha256hmkey(secret,slen,&key->hm.sha256);
+	else neosc_sha1hmkey(secret,slen,&key->hm.sha1);
+	return 0;
+}
+
+void neosc_otp_clear(NEOSC_OTP_KEY *key)
+{
+	if(key)memclear(key,0,sizeof(NEOSC_OTP_KEY));
+}
+
+int neosc_otp_hotp(NEOSC_OTP_KEY *key,unsigned long long counter,int *code)
+{
+	if(!key||!code)return -1;
+
+	*code=hotp(key,counter);
+	return 0;
+}
+
+int neosc_otp_totp(NEOSC_OTP_KEY *key,time_t time,int step,int *code)
+{
+	if(!key||time<0||step<1||!code)return -1;
+
+	*code=hotp(key,time/step);
+	return 0;
+}
+
+int neosc_otp_hotp_verify(NEOSC_OTP_KEY *key,unsigned long long counter,
+	int window,int code,unsigned long long *next)
+{
+	int i;
+	int j;
+	int match=-1;
+	int res[NEOSC_SHA1_LANES];
+
+	if(!key||window<0||code<0)return -1;
+
+	for(i=0;i<=window;i+=NEOSC_SHA1_LANES)
+	{
+		hotp_mb(key,counter+i,res);
+		for(j=0;j<NEOSC_SHA1_LANES&&i+j<=window;j++)
+			if(res[j]==code&&match==-1)match=i+j;
+	}
+	if(match==-1)return -1;
+
+	if(next)*next=counter+match+1;
+	return 0;
+}
+
+int neosc_otp_hotp_resync(NEOSC_OTP_KEY *key,unsigned long long counter,
+	int window,int code1,int code2,unsigned long long *next)
+{
+	int i;
+	int j;
+	int last;
+	int prev=-1;
+	int res[NEOSC_SHA1_LANES];
+
+	if(!key||window<0||code1<0||code2<-1)return -1;
+
+	last=code2==-1?window:window+1;
+
+	for(i=0;i<=last;i+=NEOSC_SHA1_LANES)
+	{
+		hotp_mb(key,counter+i,res);
+		for(j=0;j<NEOSC_SHA1_LANES&&i+j<=last;j++)
+		{
+			if(code2==-1?res[j]==code1:prev==code1&&res[j]==code2)
+			{
+				if(next)*next=counter+i+j+1;
+				return 0;
+			}
+			prev=res[j];
+		}
+	}
+	return -1;
+}
+
+int neosc_otp_totp_verify(NEOSC_OTP_KEY *key,time_t time,int step,int skew,
+	int code,int *offset)
+{
+	int i;
+	int match=0;
+	int found=0;
+	unsigned long long counter;
+
+	if(!key||time<0||step<1||skew<0||code<0)return -1;
+
+	counter=time/step;
+	if((unsigned long long)skew>counter)skew=counter;
+
+	for(i=skew;i>=-skew;i--)if(hotp(key,counter+i)==code)
+	{
+		if(!found||(i<0?-i:i)<=(match<0?-match:match))match=i;
+		found=1;
+	}
+	if(!found)return -1;
+
+	if(offset)*offset=match;
+	return 0;
+}
+
+int neosc_otp_hotp_check(NEOSC_OTP_KEY *key,void *store,unsigned char *id,
+	int idlen,int window,int code)
+{
+	long long value;
+	unsigned long long next;
+	unsigned char bfr[NEOSC_STORE_KEYLEN];
+
+	if(!store||!id||idlen<0||idlen>NEOSC_STORE_KEYLEN-1)return -1;
+
+	bfr[0]='H';
+	memcpy(bfr+1,id,idlen);
+	if(neosc_store_get(store,bfr,idlen+1,&value))value=0;
+	else if(value<0)return -1;
+
+	if(neosc_otp_hotp_verify(key,value,window,code,&next))return -1;
+
+	switch(neosc_store_advance(store,bfr,idlen+1,next))
+	{
+	case 0:	return 0;
+	case NEOSC_STORE_REPLAY:
+		return NEOSC_OTP_REPLAY;
+	default:return -1;
+	}
+}
+
+int neosc_otp_totp_check(NEOSC_OTP_KEY *key,void *store,unsigned char *id,
+	int idlen,time_t time,int step,int skew,int code)
+{
+	int offset;
+	unsigned char bfr[NEOSC_STORE_KEYLEN];
+
+	if(!store||!id||idlen<0||idlen>NEOSC_STORE_KEYLEN-1)return -1;
+
+	if(neosc_otp_totp_verify(key,time,step,skew,code,&offset))return -1;
+
+	bfr[0]='T';
+	memcpy(bfr+1,id,idlen);
+	switch(neosc_store_advance(store,bfr,idlen+1,time/step+offset))
+	{
+	case 0:	return 0;
+	case NEOSC_STORE_REPLAY:
+		return NEOSC_OTP_REPLAY;
+	default:return -1;
+	}
+}
@@ -19,46 +19,100 @@
  * MA  02110-1301  USA
  */
 
+#include <string.h>
 #include "libneosc.h"
+#include "crypto.h"
+
+#define memclear(a,b,c) \
+    do { memset(a,b,c); *(volatile char*)(a)=*(volatile char*)(a); } while(0)
 
 void neosc_pbkdf2(char *pass,unsigned char *salt,int slen,int iterations,
 	unsigned char *out,int olen)
 {
-        int i;
+	int i;
 	int j;
 	int k;
-        unsigned char bfr[4];
-	NEOSC_SHA1(tmp1);
-        NEOSC_SHA1(tmp2);
+	int n;
+	unsigned char bfr[4];
+	NEOSC_SHA1(tmp);
+	unsigned int u[NEOSC_SHA1_LANES*5];
+	unsigned int acc[NEOSC_SHA1_LANES*5];
 	NEOSC_SHA1HMDATA hmdata;
 	NEOSC_SHA1DATA data;
 
-	for(k=0;pass[k];k++);
-	neosc_sha1hmkey((unsigned char *)pass,k,&hmdata);
+	neosc_sha1hmkey((unsigned char *)pass,strlen(pass),&hmdata);
 
-	for(i=1;olen;i++,out+=j,olen-=j)
+	for(i=1;olen>0;)
 	{
-        	bfr[0]=(unsigned char)(i>>24);
-        	bfr[1]=(unsigned char)(i>>16);
-        	bfr[2]=(unsigned char)(i>>8);
-        	bfr[3]=(unsigned char)i;
-
-		neosc_sha1hminit(&data,&hmdata);
-		neosc_sha1hmnext(salt,slen,&data);
-		neosc_sha1hmnext(bfr,4,&data);
-		neosc_sha1hmend(tmp1,&data,&hmdata);
+		for(n=0;n<NEOSC_SHA1_LANES&&n*NEOSC_SHA1_SIZE<olen;n++,i++)
+		{
+			bfr[0]=(unsigned char)(i>>24);
+			bfr[1]=(unsigned char)(i>>16);
+			bfr[2]=(unsigned char)(i>>8);
+			bfr[3]=(unsigned char)i;
 
-		for(k=0;k<NEOSC_SHA1_SIZE;k++)tmp2[k]=tmp1[k];
+			neosc_sha1hminit(&data,&hmdata);
+			neosc_sha1hmnext(salt,slen,&data);
+			neosc_sha1hmnext(bfr,4,&data);
+			neosc_sha1hmend(tmp,&data,&hmdata);
 
-		for(k=1;k<iterations;k++)
-		{
-			neosc_sha1hmac(tmp1,NEOSC_SHA1_SIZE,tmp1,&hmdata);
-			for(j=0;j<NEOSC_SHA1_SIZE;j++)tmp2[j]^=tmp1[j];
+			for(k=0;k<5;k++)u[n*5+k]=acc[n*5+k]=(tmp[k<<2]<<24)|
+				(tmp[(k<<2)+1]<<16)|(tmp[(k<<2)+2]<<8)|
+				tmp[(k<<2)+3];
 		}
 
-		j=olen>NEOSC_SHA1_SIZE?NEOSC_SHA1_SIZE:olen;
-		for(k=0;k<j;k++)out[k]=tmp2[k];
+		if(n==1)neosc_sha1_iterate(&hmdata,u,acc,iterations-1);
+		else neosc_sha1_iterate_mb(&hmdata,u,acc,n,iterations-1);
+
+		for(j=0;j<n;j++)for(k=0;k<NEOSC_SHA1_SIZE&&olen;k++,olen--)
+			*out++=(unsigned char)(acc[j*5+(k>>2)]>>(24-((k&3)<<3)));
+	}
+
+	memclear(&hmdata,0,sizeof(hmdata));
+	memclear(&data,0,sizeof(data));
+	memclear(u,0,sizeof(u));
+	memclear(acc,0,sizeof(acc));
+	memclear(tmp,0,sizeof(tmp));
+}
+
+void neosc_pbkdf2_sha256(char *pass,unsigned char *salt,int slen,
+	int iterations,unsigned char *out,int olen)
+{
+	int i;
+	int k;
+	unsigned char bfr[4];
+	NEOSC_SHA256(tmp);
+	unsigned int u[8];
+	unsigned int acc[8];
+	NEOSC_SHA256HMDATA hmdata;
+	NEOSC_SHA256DATA data;
+
+	neosc_sha256hmkey((unsigned char *)pass,strlen(pass),&hmdata);
+
+	for(i=1;olen>0;i++)
+	{
+		bfr[0]=(unsigned char)(i>>24);
+		bfr[1]=(unsigned char)(i>>16);
+		bfr[2]=(unsigned char)(i>>8);
+		bfr[3]=(unsigned char)i;
+
+		neosc_sha256hminit(&data,&hmdata);
+		neosc_sha256hmnext(salt,slen,&data);
+		neosc_sha256hmnext(bfr,4,&data);
+		neosc_sha256hmend(tmp,&data,&hmdata);
+
+		for(k=0;k<8;k++)u[k]=acc[k]=(tmp[k<<2]<<24)|
+			(tmp[(k<<2)+1]<<16)|(tmp[(k<<2)+2]<<8)|tmp[(k<<2)+3];
+
+		neosc_sha256_iterate(&hmdata,u,acc,iterations-1);
+
+		for(k=0;k<NEOSC_SHA256_SIZE&&olen;k++,olen--)
+			*out++=(unsigned char)(acc[k>>2]>>(24-((k&3)<<3)));
 	}
 
-	for(k=0;k<sizeof(hmdata);k++)((unsigned char *)&hmdata)[k]=0;
+	memclear(&hmdata,0,sizeof(hmdata));
+	memclear(&data,0,sizeof(data));
+	memclear(u,0,sizeof(u));
+	memclear(acc,0,sizeof(acc));
+	memclear(tmp,0,sizeof(tmp));
 }
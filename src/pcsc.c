@@ -22,9 +22,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <pcsclite.h>
-#include <winscard.h>
 #include "libneosc.h"
+#include "internal.h"
 
 #define USB 0
 #define NFC 1
@@ -36,13 +35,6 @@
 #define U2F_ID1     "U2F"
 #define U2F_ID2     "FIDO"
 
-typedef struct
-{
-	SCARDCONTEXT card;
-	SCARDHANDLE handle;
-	int lock;
-} CTX;
-
 typedef struct
 {
 	char *name;
@@ -106,6 +98,7 @@ static void fini_pcsc(void *ctx)
 
 	if(!ctx)return;
 	SCardReleaseContext(_ctx->card);
+	neosc_oath_cache_free(ctx);
 	free(ctx);
 }
 
@@ -190,6 +183,7 @@ static int pcsc_apdu(void *ctx,unsigned char *in,int ilen,unsigned char *out,
 		if(SCardReconnect(_ctx->handle,SCARD_SHARE_SHARED,
 			SCARD_PROTOCOL_T0|SCARD_PROTOCOL_T1,SCARD_LEAVE_CARD,
 			&unused)!=SCARD_S_SUCCESS)return -1;
+		_ctx->stateok=0;
 		if(_ctx->lock)if(SCardBeginTransaction(_ctx->card)!=
 			SCARD_S_SUCCESS)return -1;
 		len=*olen;
@@ -245,6 +239,7 @@ int neosc_pcsc_lock(void *ctx)
 			return -1;
 	case SCARD_S_SUCCESS:
 		_ctx->lock=1;
+		_ctx->stateok=0;
 		return 0;
 
 	default:return -1;
@@ -265,6 +260,7 @@ int neosc_pcsc_unlock(void *ctx)
 			&unused)!=SCARD_S_SUCCESS)return -1;
 	case SCARD_S_SUCCESS:
 		_ctx->lock=0;
+		_ctx->stateok=0;
 		return 0;
 
 	default:return -1;
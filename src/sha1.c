@@ -19,144 +19,52 @@
  * MA  02110-1301  USA
  */
 
+#define _FILE_OFFSET_BITS 64
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define X86
+#endif
 #include "libneosc.h"
-
-static void sha1block(unsigned int *sha1,unsigned char *data)
+#include "crypto.h"
+
+#define MAPCHUNK	0x40000000
+#define READCHUNK	0x100000
+
+#ifdef __GNUC__
+typedef unsigned int v8u __attribute__((vector_size(32)));
+#define rolv(a,n) (((a)<<(n))|((a)>>(32-(n))))
+#define WV(i) (w[(i)&15]=rolv(w[((i)+13)&15]^w[((i)+8)&15]^ \
+	w[((i)+2)&15]^w[(i)&15],1))
+#define RV0(a,b,c,d,e,i) \
+	e+=rolv(a,5)+(((c^d)&b)^d)+0x5A827999+w[i];b=rolv(b,30)
+#define RV1(a,b,c,d,e,i) \
+	e+=rolv(a,5)+(((c^d)&b)^d)+0x5A827999+WV(i);b=rolv(b,30)
+#define RV2(a,b,c,d,e,i) \
+	e+=rolv(a,5)+(b^c^d)+0x6ED9EBA1+WV(i);b=rolv(b,30)
+#define RV3(a,b,c,d,e,i) \
+	e+=rolv(a,5)+((b&c)|((b|c)&d))+0x8F1BBCDC+WV(i);b=rolv(b,30)
+#define RV4(a,b,c,d,e,i) \
+	e+=rolv(a,5)+(b^c^d)+0xCA62C1D6+WV(i);b=rolv(b,30)
+#define RVX(R,i) \
+	R(a,b,c,d,e,i);R(e,a,b,c,d,i+1);R(d,e,a,b,c,i+2); \
+	R(c,d,e,a,b,i+3);R(b,c,d,e,a,i+4)
+#endif
+
+static void sha1wblock_std(unsigned int *sha1,unsigned int *w)
 {
 	register unsigned int a;
 	register unsigned int b;
 	register unsigned int c;
 	register unsigned int d;
 	register unsigned int e;
-	unsigned int w[16];
-
-	a=data[0];
-	a<<=8;
-	a+=data[1];
-	a<<=8;
-	a+=data[2];
-	a<<=8;
-	w[0]=a+data[3];
-
-	a=data[4];
-	a<<=8;
-	a+=data[5];
-	a<<=8;
-	a+=data[6];
-	a<<=8;
-	w[1]=a+data[7];
-
-	a=data[8];
-	a<<=8;
-	a+=data[9];
-	a<<=8;
-	a+=data[10];
-	a<<=8;
-	w[2]=a+data[11];
-
-	a=data[12];
-	a<<=8;
-	a+=data[13];
-	a<<=8;
-	a+=data[14];
-	a<<=8;
-	w[3]=a+data[15];
-
-	a=data[16];
-	a<<=8;
-	a+=data[17];
-	a<<=8;
-	a+=data[18];
-	a<<=8;
-	w[4]=a+data[19];
-
-	a=data[20];
-	a<<=8;
-	a+=data[21];
-	a<<=8;
-	a+=data[22];
-	a<<=8;
-	w[5]=a+data[23];
-
-	a=data[24];
-	a<<=8;
-	a+=data[25];
-	a<<=8;
-	a+=data[26];
-	a<<=8;
-	w[6]=a+data[27];
-
-	a=data[28];
-	a<<=8;
-	a+=data[29];
-	a<<=8;
-	a+=data[30];
-	a<<=8;
-	w[7]=a+data[31];
-
-	a=data[32];
-	a<<=8;
-	a+=data[33];
-	a<<=8;
-	a+=data[34];
-	a<<=8;
-	w[8]=a+data[35];
-
-	a=data[36];
-	a<<=8;
-	a+=data[37];
-	a<<=8;
-	a+=data[38];
-	a<<=8;
-	w[9]=a+data[39];
-
-	a=data[40];
-	a<<=8;
-	a+=data[41];
-	a<<=8;
-	a+=data[42];
-	a<<=8;
-	w[10]=a+data[43];
-
-	a=data[44];
-	a<<=8;
-	a+=data[45];
-	a<<=8;
-	a+=data[46];
-	a<<=8;
-	w[11]=a+data[47];
-
-	a=data[48];
-	a<<=8;
-	a+=data[49];
-	a<<=8;
-	a+=data[50];
-	a<<=8;
-	w[12]=a+data[51];
-
-	a=data[52];
-	a<<=8;
-	a+=data[53];
-	a<<=8;
-	a+=data[54];
-	a<<=8;
-	w[13]=a+data[55];
-
-	a=data[56];
-	a<<=8;
-	a+=data[57];
-	a<<=8;
-	a+=data[58];
-	a<<=8;
-	w[14]=a+data[59];
-
-	a=data[60];
-	a<<=8;
-	a+=data[61];
-	a<<=8;
-	a+=data[62];
-	a<<=8;
-	w[15]=a+data[63];
 
 	a=sha1[0];
 	b=sha1[1];
@@ -779,6 +687,506 @@ static void sha1block(unsigned int *sha1,unsigned char *data)
 	sha1[4]+=e;
 }
 
+static void sha1block_std(unsigned int *sha1,unsigned char *data)
+{
+	register unsigned int a;
+	unsigned int w[16];
+
+	a=data[0];
+	a<<=8;
+	a+=data[1];
+	a<<=8;
+	a+=data[2];
+	a<<=8;
+	w[0]=a+data[3];
+
+	a=data[4];
+	a<<=8;
+	a+=data[5];
+	a<<=8;
+	a+=data[6];
+	a<<=8;
+	w[1]=a+data[7];
+
+	a=data[8];
+	a<<=8;
+	a+=data[9];
+	a<<=8;
+	a+=data[10];
+	a<<=8;
+	w[2]=a+data[11];
+
+	a=data[12];
+	a<<=8;
+	a+=data[13];
+	a<<=8;
+	a+=data[14];
+	a<<=8;
+	w[3]=a+data[15];
+
+	a=data[16];
+	a<<=8;
+	a+=data[17];
+	a<<=8;
+	a+=data[18];
+	a<<=8;
+	w[4]=a+data[19];
+
+	a=data[20];
+	a<<=8;
+	a+=data[21];
+	a<<=8;
+	a+=data[22];
+	a<<=8;
+	w[5]=a+data[23];
+
+	a=data[24];
+	a<<=8;
+	a+=data[25];
+	a<<=8;
+	a+=data[26];
+	a<<=8;
+	w[6]=a+data[27];
+
+	a=data[28];
+	a<<=8;
+	a+=data[29];
+	a<<=8;
+	a+=data[30];
+	a<<=8;
+	w[7]=a+data[31];
+
+	a=data[32];
+	a<<=8;
+	a+=data[33];
+	a<<=8;
+	a+=data[34];
+	a<<=8;
+	w[8]=a+data[35];
+
+	a=data[36];
+	a<<=8;
+	a+=data[37];
+	a<<=8;
+	a+=data[38];
+	a<<=8;
+	w[9]=a+data[39];
+
+	a=data[40];
+	a<<=8;
+	a+=data[41];
+	a<<=8;
+	a+=data[42];
+	a<<=8;
+	w[10]=a+data[43];
+
+	a=data[44];
+	a<<=8;
+	a+=data[45];
+	a<<=8;
+	a+=data[46];
+	a<<=8;
+	w[11]=a+data[47];
+
+	a=data[48];
+	a<<=8;
+	a+=data[49];
+	a<<=8;
+	a+=data[50];
+	a<<=8;
+	w[12]=a+data[51];
+
+	a=data[52];
+	a<<=8;
+	a+=data[53];
+	a<<=8;
+	a+=data[54];
+	a<<=8;
+	w[13]=a+data[55];
+
+	a=data[56];
+	a<<=8;
+	a+=data[57];
+	a<<=8;
+	a+=data[58];
+	a<<=8;
+	w[14]=a+data[59];
+
+	a=data[60];
+	a<<=8;
+	a+=data[61];
+	a<<=8;
+	a+=data[62];
+	a<<=8;
+	w[15]=a+data[63];
+
+	sha1wblock_std(sha1,w);
+}
+
+#ifdef X86
+
+#define NIR(e0,e1,m0,m1,m2,m3,f) \
+	e0=_mm_sha1nexte_epu32(e0,m0); \
+	e1=abcd; \
+	m1=_mm_sha1msg2_epu32(m1,m0); \
+	abcd=_mm_sha1rnds4_epu32(abcd,e0,f); \
+	m3=_mm_sha1msg1_epu32(m3,m0); \
+	m2=_mm_xor_si128(m2,m0)
+
+__attribute__((target("sha,ssse3,sse4.1"))) static inline
+	__attribute__((always_inline)) void sha1ni(unsigned int *sha1,
+	__m128i m0,__m128i m1,__m128i m2,__m128i m3)
+{
+	__m128i abcd;
+	__m128i save;
+	__m128i e0;
+	__m128i e1;
+
+	abcd=_mm_shuffle_epi32(_mm_loadu_si128((__m128i *)sha1),0x1b);
+	save=abcd;
+	e0=_mm_set_epi32(sha1[4],0,0,0);
+
+	e0=_mm_add_epi32(e0,m0);
+	e1=abcd;
+	abcd=_mm_sha1rnds4_epu32(abcd,e0,0);
+
+	e1=_mm_sha1nexte_epu32(e1,m1);
+	e0=abcd;
+	abcd=_mm_sha1rnds4_epu32(abcd,e1,0);
+	m0=_mm_sha1msg1_epu32(m0,m1);
+
+	e0=_mm_sha1nexte_epu32(e0,m2);
+	e1=abcd;
+	abcd=_mm_sha1rnds4_epu32(abcd,e0,0);
+	m1=_mm_sha1msg1_epu32(m1,m2);
+	m0=_mm_xor_si128(m0,m2);
+
+	NIR(e1,e0,m3,m0,m1,m2,0);
+	NIR(e0,e1,m0,m1,m2,m3,0);
+	NIR(e1,e0,m1,m2,m3,m0,1);
+	NIR(e0,e1,m2,m3,m0,m1,1);
+	NIR(e1,e0,m3,m0,m1,m2,1);
+	NIR(e0,e1,m0,m1,m2,m3,1);
+	NIR(e1,e0,m1,m2,m3,m0,1);
+	NIR(e0,e1,m2,m3,m0,m1,2);
+	NIR(e1,e0,m3,m0,m1,m2,2);
+	NIR(e0,e1,m0,m1,m2,m3,2);
+	NIR(e1,e0,m1,m2,m3,m0,2);
+	NIR(e0,e1,m2,m3,m0,m1,2);
+	NIR(e1,e0,m3,m0,m1,m2,3);
+	NIR(e0,e1,m0,m1,m2,m3,3);
+
+	e1=_mm_sha1nexte_epu32(e1,m1);
+	e0=abcd;
+	m2=_mm_sha1msg2_epu32(m2,m1);
+	abcd=_mm_sha1rnds4_epu32(abcd,e1,3);
+	m3=_mm_xor_si128(m3,m1);
+
+	e0=_mm_sha1nexte_epu32(e0,m2);
+	e1=abcd;
+	m3=_mm_sha1msg2_epu32(m3,m2);
+	abcd=_mm_sha1rnds4_epu32(abcd,e0,3);
+
+	e1=_mm_sha1nexte_epu32(e1,m3);
+	e0=abcd;
+	abcd=_mm_sha1rnds4_epu32(abcd,e1,3);
+
+	e0=_mm_sha1nexte_epu32(e0,_mm_set_epi32(sha1[4],0,0,0));
+	abcd=_mm_add_epi32(abcd,save);
+
+	_mm_storeu_si128((__m128i *)sha1,_mm_shuffle_epi32(abcd,0x1b));
+	sha1[4]=_mm_extract_epi32(e0,3);
+}
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void sha1block_ni(unsigned int *sha1,unsigned char *data)
+{
+	__m128i mask;
+
+	mask=_mm_set_epi64x(0x0001020304050607ULL,0x08090a0b0c0d0e0fULL);
+
+	sha1ni(sha1,_mm_shuffle_epi8(_mm_loadu_si128((__m128i *)data),mask),
+		_mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(data+16)),mask),
+		_mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(data+32)),mask),
+		_mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(data+48)),mask));
+}
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void sha1wblock_ni(unsigned int *sha1,unsigned int *w)
+{
+	sha1ni(sha1,_mm_shuffle_epi32(_mm_loadu_si128((__m128i *)w),0x1b),
+		_mm_shuffle_epi32(_mm_loadu_si128((__m128i *)(w+4)),0x1b),
+		_mm_shuffle_epi32(_mm_loadu_si128((__m128i *)(w+8)),0x1b),
+		_mm_shuffle_epi32(_mm_loadu_si128((__m128i *)(w+12)),0x1b));
+}
+
+#endif
+
+#ifdef __GNUC__
+
+static inline __attribute__((always_inline)) void sha1wblock8(v8u *sha1,
+	v8u *w)
+{
+	register int i;
+	register v8u a;
+	register v8u b;
+	register v8u c;
+	register v8u d;
+	register v8u e;
+
+	a=sha1[0];
+	b=sha1[1];
+	c=sha1[2];
+	d=sha1[3];
+	e=sha1[4];
+
+	for(i=0;i<15;i+=5)
+	{
+		RVX(RV0,i);
+	}
+	RV0(a,b,c,d,e,15);
+	RV1(e,a,b,c,d,16);
+	RV1(d,e,a,b,c,17);
+	RV1(c,d,e,a,b,18);
+	RV1(b,c,d,e,a,19);
+	for(i=20;i<40;i+=5)
+	{
+		RVX(RV2,i);
+	}
+	for(;i<60;i+=5)
+	{
+		RVX(RV3,i);
+	}
+	for(;i<80;i+=5)
+	{
+		RVX(RV4,i);
+	}
+
+	sha1[0]+=a;
+	sha1[1]+=b;
+	sha1[2]+=c;
+	sha1[3]+=d;
+	sha1[4]+=e;
+}
+
+static inline __attribute__((always_inline)) void sha1block8(v8u *sha1,
+	unsigned char **data)
+{
+	register int i;
+	register int j;
+	unsigned int t;
+	v8u w[16];
+
+	for(j=0;j<8;j++)for(i=0;i<16;i++)
+	{
+		memcpy(&t,data[j]+(i<<2),4);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		w[i][j]=__builtin_bswap32(t);
+#else
+		w[i][j]=t;
+#endif
+	}
+
+	sha1wblock8(sha1,w);
+}
+
+static inline __attribute__((always_inline)) void iterate8(
+	NEOSC_SHA1HMDATA *key,unsigned int *u,unsigned int *acc,int total,
+	int iterations)
+{
+	register int i;
+	register int j;
+	v8u is[5];
+	v8u os[5];
+	v8u x[5];
+	v8u h[5];
+	v8u a[5];
+	v8u w[16];
+
+	for(i=0;i<5;i++)for(j=0;j<8;j++)
+	{
+		is[i][j]=key->isha1[i];
+		os[i][j]=key->osha1[i];
+		x[i][j]=u[(j<total?j:0)*5+i];
+		a[i][j]=acc[(j<total?j:0)*5+i];
+	}
+
+	for(;iterations>0;iterations--)
+	{
+		for(i=0;i<5;i++)
+		{
+			w[i]=x[i];
+			h[i]=is[i];
+		}
+		for(j=0;j<8;j++)
+		{
+			w[5][j]=0x80000000;
+			w[15][j]=(64+NEOSC_SHA1_SIZE)<<3;
+		}
+		for(i=6;i<15;i++)w[i]=(v8u){0};
+		sha1wblock8(h,w);
+
+		for(i=0;i<5;i++)
+		{
+			w[i]=h[i];
+			x[i]=os[i];
+		}
+		for(j=0;j<8;j++)
+		{
+			w[5][j]=0x80000000;
+			w[15][j]=(64+NEOSC_SHA1_SIZE)<<3;
+		}
+		for(i=6;i<15;i++)w[i]=(v8u){0};
+		sha1wblock8(x,w);
+
+		for(i=0;i<5;i++)a[i]^=x[i];
+	}
+
+	for(i=0;i<5;i++)for(j=0;j<total;j++)
+	{
+		u[j*5+i]=x[i][j];
+		acc[j*5+i]=a[i][j];
+	}
+}
+
+static void sha1block8_std(v8u *sha1,unsigned char **data)
+{
+	sha1block8(sha1,data);
+}
+
+static void iterate8_std(NEOSC_SHA1HMDATA *key,unsigned int *u,
+	unsigned int *acc,int total,int iterations)
+{
+	iterate8(key,u,acc,total,iterations);
+}
+
+#ifdef X86
+
+__attribute__((target("avx2")))
+static void sha1block8_avx2(v8u *sha1,unsigned char **data)
+{
+	sha1block8(sha1,data);
+}
+
+__attribute__((target("avx2")))
+static void iterate8_avx2(NEOSC_SHA1HMDATA *key,unsigned int *u,
+	unsigned int *acc,int total,int iterations)
+{
+	iterate8(key,u,acc,total,iterations);
+}
+
+#endif
+
+static void (*iteratemb)(NEOSC_SHA1HMDATA *key,unsigned int *u,
+	unsigned int *acc,int total,int iterations)=iterate8_std;
+static int usemb=1;
+static void (*sha1blockmb)(v8u *sha1,unsigned char **data)=sha1block8_std;
+
+#endif
+
+static void (*sha1block)(unsigned int *sha1,unsigned char *data)=sha1block_std;
+static void (*sha1wblock)(unsigned int *sha1,unsigned int *w)=sha1wblock_std;
+
+int neosc_sha1_select(int mask)
+{
+	int r=0;
+
+	sha1block=sha1block_std;
+	sha1wblock=sha1wblock_std;
+#ifdef __GNUC__
+	sha1blockmb=sha1block8_std;
+	iteratemb=iterate8_std;
+	usemb=1;
+#endif
+#ifdef X86
+	__builtin_cpu_init();
+	if((mask&NEOSC_CPU_SHANI)&&__builtin_cpu_supports("sha")&&
+		__builtin_cpu_supports("sse4.1"))
+	{
+		sha1block=sha1block_ni;
+		sha1wblock=sha1wblock_ni;
+		usemb=0;
+		r|=NEOSC_CPU_SHANI;
+	}
+	if((mask&NEOSC_CPU_AVX2)&&__builtin_cpu_supports("avx2"))
+	{
+		sha1blockmb=sha1block8_avx2;
+		iteratemb=iterate8_avx2;
+		usemb=1;
+		r|=NEOSC_CPU_AVX2;
+	}
+#endif
+	return r;
+}
+
+#ifdef X86
+
+__attribute__((constructor)) static void sha1setup(void)
+{
+	neosc_sha1_select(NEOSC_CPU_SHANI|NEOSC_CPU_AVX2);
+}
+
+#endif
+
+static inline void putbe(unsigned char *dst,unsigned int val)
+{
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	val=__builtin_bswap32(val);
+	memcpy(dst,&val,4);
+#elif defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	memcpy(dst,&val,4);
+#else
+	dst[0]=(unsigned char)(val>>24);
+	dst[1]=(unsigned char)(val>>16);
+	dst[2]=(unsigned char)(val>>8);
+	dst[3]=(unsigned char)val;
+#endif
+}
+
+static void result1(unsigned char *result,unsigned int *sha1)
+{
+	putbe(result,sha1[0]);
+	putbe(result+4,sha1[1]);
+	putbe(result+8,sha1[2]);
+	putbe(result+12,sha1[3]);
+	putbe(result+16,sha1[4]);
+}
+
+static void sha1pad(unsigned int *sha1,unsigned char *bfr,unsigned int size,
+	unsigned long long total)
+{
+	bfr[size++]=0x80;
+	if(size>56)
+	{
+		memset(bfr+size,0,64-size);
+		sha1block(sha1,bfr);
+		size=0;
+	}
+	memset(bfr+size,0,56-size);
+	putbe(bfr+56,(unsigned int)(total>>29));
+	putbe(bfr+60,(unsigned int)(total<<3));
+	sha1block(sha1,bfr);
+}
+
+static void sha1outer(unsigned char *result,unsigned int *inner,
+	NEOSC_SHA1HMDATA *key)
+{
+	register int i;
+	unsigned int w[16];
+	unsigned int sha1[5];
+
+	for(i=0;i<5;i++)
+	{
+		w[i]=inner[i];
+		sha1[i]=key->osha1[i];
+	}
+	w[5]=0x80000000;
+	for(i=6;i<15;i++)w[i]=0;
+	w[15]=(64+NEOSC_SHA1_SIZE)<<3;
+	sha1wblock(sha1,w);
+	result1(result,sha1);
+}
+
 void neosc_sha1init(register NEOSC_SHA1DATA *ptr)
 {
 	ptr->total=ptr->size=0;
@@ -792,73 +1200,38 @@ void neosc_sha1init(register NEOSC_SHA1DATA *ptr)
 void neosc_sha1next(register unsigned char *data,register unsigned int length,
 	register NEOSC_SHA1DATA *ptr)
 {
-	register unsigned int i;
+	register unsigned int i=ptr->size;
 
 	ptr->total+=length;
 
-	for(i=ptr->size;(i&63)&&length;length--)ptr->bfr.b[i++]=*data++;
-
-	if(i==64)
+	if(i)
 	{
-		i=0;
+		if(length<64-i)
+		{
+			memcpy(ptr->bfr.b+i,data,length);
+			ptr->size=(unsigned char)(i+length);
+			return;
+		}
+		memcpy(ptr->bfr.b+i,data,64-i);
 		sha1block(ptr->sha1,ptr->bfr.b);
+		data+=64-i;
+		length-=64-i;
 	}
 
 	for(;length>63;length-=64,data+=64)sha1block(ptr->sha1,data);
-	for(;length;length--)ptr->bfr.b[i++]=*data++;
-	ptr->size=(unsigned char)(i);
+	memcpy(ptr->bfr.b,data,length);
+	ptr->size=(unsigned char)(length);
 }
 
 void neosc_sha1end(register unsigned char *result,register NEOSC_SHA1DATA *ptr)
 {
-	register unsigned int i=ptr->size;
-
-	ptr->bfr.b[i++]=0x80;
-	if(i>56)
-	{
-		for(;i<64;i++)ptr->bfr.b[i]=0;
-		i=0;
-		sha1block(ptr->sha1,ptr->bfr.b);
-	}
-	for(;i<56;i++)ptr->bfr.b[i]=0;
-
-	ptr->bfr.b[56]=0;
-	ptr->bfr.b[57]=0;
-	ptr->bfr.b[58]=0;
-	ptr->bfr.b[59]=(unsigned char)((ptr->total)>>29);
-	ptr->bfr.b[60]=(unsigned char)((ptr->total)>>21);
-	ptr->bfr.b[61]=(unsigned char)((ptr->total)>>13);
-	ptr->bfr.b[62]=(unsigned char)((ptr->total)>>5);
-	ptr->bfr.b[63]=(unsigned char)((ptr->total)<<3);
-
-	sha1block(ptr->sha1,ptr->bfr.b);
-
-	result[ 0]=(unsigned char)((ptr->sha1[0])>>24);
-	result[ 1]=(unsigned char)((ptr->sha1[0])>>16);
-	result[ 2]=(unsigned char)((ptr->sha1[0])>>8);
-	result[ 3]=(unsigned char) (ptr->sha1[0]);
-	result[ 4]=(unsigned char)((ptr->sha1[1])>>24);
-	result[ 5]=(unsigned char)((ptr->sha1[1])>>16);
-	result[ 6]=(unsigned char)((ptr->sha1[1])>>8);
-	result[ 7]=(unsigned char) (ptr->sha1[1]);
-	result[ 8]=(unsigned char)((ptr->sha1[2])>>24);
-	result[ 9]=(unsigned char)((ptr->sha1[2])>>16);
-	result[10]=(unsigned char)((ptr->sha1[2])>>8);
-	result[11]=(unsigned char) (ptr->sha1[2]);
-	result[12]=(unsigned char)((ptr->sha1[3])>>24);
-	result[13]=(unsigned char)((ptr->sha1[3])>>16);
-	result[14]=(unsigned char)((ptr->sha1[3])>>8);
-	result[15]=(unsigned char) (ptr->sha1[3]);
-	result[16]=(unsigned char)((ptr->sha1[4])>>24);
-	result[17]=(unsigned char)((ptr->sha1[4])>>16);
-	result[18]=(unsigned char)((ptr->sha1[4])>>8);
-	result[19]=(unsigned char) (ptr->sha1[4]);
+	sha1pad(ptr->sha1,ptr->bfr.b,ptr->size,ptr->total);
+	result1(result,ptr->sha1);
 }
 
 void neosc_sha1(register unsigned char *data,register unsigned int length,
 	unsigned char *result)
 {
-	register unsigned int i;
 	unsigned int total;
 	unsigned int sha1[5];
 	unsigned char bfr[64];
@@ -871,46 +1244,63 @@ void neosc_sha1(register unsigned char *data,register unsigned int length,
 	sha1[4]=0xC3D2E1F0;
 
 	for(;length>63;length-=64,data+=64)sha1block(sha1,data);
-	for(i=0;length;length--)bfr[i++]=*data++;
-	bfr[i++]=0x80;
-	if(i>56)
+	memcpy(bfr,data,length);
+	sha1pad(sha1,bfr,length,total);
+	result1(result,sha1);
+}
+
+int neosc_sha1_file(char *file,unsigned char *result)
+{
+	int r=-1;
+	int fd;
+	ssize_t l;
+	size_t len;
+	unsigned long long pos;
+	unsigned long long size;
+	unsigned char *bfr;
+	struct stat stb;
+	NEOSC_SHA1DATA sha1data;
+
+	if((fd=open(file,O_RDONLY|O_CLOEXEC))==-1)return -1;
+	if(fstat(fd,&stb))goto err1;
+	neosc_sha1init(&sha1data);
+
+	size=stb.st_size;
+	if(S_ISREG(stb.st_mode)&&size&&size==(size_t)size&&
+		(bfr=mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0))!=MAP_FAILED)
 	{
-		for(;i<64;i++)bfr[i]=0;
-		i=0;
-		sha1block(sha1,bfr);
+		madvise(bfr,size,MADV_SEQUENTIAL);
+		for(pos=0;pos<size;pos+=len)
+		{
+			len=size-pos>MAPCHUNK?MAPCHUNK:size-pos;
+			neosc_sha1next(bfr+pos,len,&sha1data);
+		}
+		munmap(bfr,size);
+		goto out;
 	}
-	for(;i<56;i++)bfr[i]=0;
-	bfr[56]=0;
-	bfr[57]=0;
-	bfr[58]=0;
-	bfr[59]=(unsigned char)((total)>>29);
-	bfr[60]=(unsigned char)(total>>21);
-	bfr[61]=(unsigned char)(total>>13);
-	bfr[62]=(unsigned char)(total>>5);
-	bfr[63]=(unsigned char)(total<<3);
 
-	sha1block(sha1,bfr);
-
-	result[ 0]=(unsigned char)((sha1[0])>>24);
-	result[ 1]=(unsigned char)((sha1[0])>>16);
-	result[ 2]=(unsigned char)((sha1[0])>>8);
-	result[ 3]=(unsigned char) (sha1[0]);
-	result[ 4]=(unsigned char)((sha1[1])>>24);
-	result[ 5]=(unsigned char)((sha1[1])>>16);
-	result[ 6]=(unsigned char)((sha1[1])>>8);
-	result[ 7]=(unsigned char) (sha1[1]);
-	result[ 8]=(unsigned char)((sha1[2])>>24);
-	result[ 9]=(unsigned char)((sha1[2])>>16);
-	result[10]=(unsigned char)((sha1[2])>>8);
-	result[11]=(unsigned char) (sha1[2]);
-	result[12]=(unsigned char)((sha1[3])>>24);
-	result[13]=(unsigned char)((sha1[3])>>16);
-	result[14]=(unsigned char)((sha1[3])>>8);
-	result[15]=(unsigned char) (sha1[3]);
-	result[16]=(unsigned char)((sha1[4])>>24);
-	result[17]=(unsigned char)((sha1[4])>>16);
-	result[18]=(unsigned char)((sha1[4])>>8);
-	result[19]=(unsigned char) (sha1[4]);
+	posix_fadvise(fd,0,0,POSIX_FADV_SEQUENTIAL);
+	if(posix_memalign((void **)&bfr,4096,READCHUNK))goto err1;
+	do
+	{
+		for(len=0;len<READCHUNK;len+=l)
+			if((l=read(fd,bfr+len,READCHUNK-len))<=0)
+		{
+			if(l==-1&&errno==EINTR)l=0;
+			else if(l==-1)goto err2;
+			else break;
+		}
+		neosc_sha1next(bfr,len,&sha1data);
+	} while(len==READCHUNK);
+	free(bfr);
+
+out:	neosc_sha1end(result,&sha1data);
+	r=0;
+	goto err1;
+
+err2:	free(bfr);
+err1:	close(fd);
+	return r;
 }
 
 void neosc_sha1hmkey(unsigned char *key,unsigned int keylength,
@@ -968,18 +1358,8 @@ void neosc_sha1hminit(NEOSC_SHA1DATA *ptr,NEOSC_SHA1HMDATA *key)
 void neosc_sha1hmend(unsigned char *result,NEOSC_SHA1DATA *ptr,
 	NEOSC_SHA1HMDATA *key)
 {
-	neosc_sha1end(result,ptr);
-
-	ptr->total=64;
-	ptr->size=0;
-	ptr->sha1[0]=key->osha1[0];
-	ptr->sha1[1]=key->osha1[1];
-	ptr->sha1[2]=key->osha1[2];
-	ptr->sha1[3]=key->osha1[3];
-	ptr->sha1[4]=key->osha1[4];
-
-	neosc_sha1next(result,NEOSC_SHA1_SIZE,ptr);
-	neosc_sha1end(result,ptr);
+	sha1pad(ptr->sha1,ptr->bfr.b,ptr->size,ptr->total);
+	sha1outer(result,ptr->sha1,key);
 }
 
 void neosc_sha1hmac(unsigned char *data,unsigned int length,
@@ -987,25 +1367,173 @@ void neosc_sha1hmac(unsigned char *data,unsigned int length,
 {
 	NEOSC_SHA1DATA sha1data;
 
-	sha1data.total=64;
-	sha1data.size=0;
-	sha1data.sha1[0]=key->isha1[0];
-	sha1data.sha1[1]=key->isha1[1];
-	sha1data.sha1[2]=key->isha1[2];
-	sha1data.sha1[3]=key->isha1[3];
-	sha1data.sha1[4]=key->isha1[4];
-
+	neosc_sha1hminit(&sha1data,key);
 	neosc_sha1next(data,length,&sha1data);
-	neosc_sha1end(result,&sha1data);
-
-	sha1data.total=64;
-	sha1data.size=0;
-	sha1data.sha1[0]=key->osha1[0];
-	sha1data.sha1[1]=key->osha1[1];
-	sha1data.sha1[2]=key->osha1[2];
-	sha1data.sha1[3]=key->osha1[3];
-	sha1data.sha1[4]=key->osha1[4];
-
-	neosc_sha1next(result,NEOSC_SHA1_SIZE,&sha1data);
-	neosc_sha1end(result,&sha1data);
+	neosc_sha1hmend(result,&sha1data,key);
+}
+
+#ifdef __GNUC__
+
+static void sha1mb(unsigned char **data,unsigned int length,
+	unsigned char **result,NEOSC_SHA1HMDATA **key,int total)
+{
+	register unsigned int i;
+	register int j;
+	unsigned long long size;
+	v8u sha1[5];
+	unsigned char *ptr[8];
+	unsigned char bfr[8][128];
+
+	for(j=0;j<8;j++)
+	{
+		if(!key)
+		{
+			sha1[0][j]=0x67452301;
+			sha1[1][j]=0xEFCDAB89;
+			sha1[2][j]=0x98BADCFE;
+			sha1[3][j]=0x10325476;
+			sha1[4][j]=0xC3D2E1F0;
+		}
+		else for(i=0;i<5;i++)sha1[i][j]=key[j<total?j:0]->isha1[i];
+	}
+
+	for(i=0;i+64<=length;i+=64)
+	{
+		for(j=0;j<8;j++)ptr[j]=data[j<total?j:0]+i;
+		sha1blockmb(sha1,ptr);
+	}
+
+	size=key?length+64:length;
+	length-=i;
+	for(j=0;j<8;j++)
+	{
+		memcpy(bfr[j],data[j<total?j:0]+i,length);
+		memset(bfr[j]+length,0,128-length);
+		bfr[j][length]=0x80;
+		ptr[j]=bfr[j];
+	}
+	i=length<56?64:128;
+	for(j=0;j<8;j++)
+	{
+		bfr[j][i-5]=(unsigned char)(size>>29);
+		bfr[j][i-4]=(unsigned char)(size>>21);
+		bfr[j][i-3]=(unsigned char)(size>>13);
+		bfr[j][i-2]=(unsigned char)(size>>5);
+		bfr[j][i-1]=(unsigned char)(size<<3);
+	}
+	sha1blockmb(sha1,ptr);
+	if(i==128)
+	{
+		for(j=0;j<8;j++)ptr[j]=bfr[j]+64;
+		sha1blockmb(sha1,ptr);
+	}
+
+	if(key)
+	{
+		for(j=0;j<8;j++)
+		{
+			for(i=0;i<5;i++)
+			{
+				bfr[j][i<<2]=(unsigned char)(sha1[i][j]>>24);
+				bfr[j][(i<<2)+1]=(unsigned char)(sha1[i][j]>>16);
+				bfr[j][(i<<2)+2]=(unsigned char)(sha1[i][j]>>8);
+				bfr[j][(i<<2)+3]=(unsigned char)sha1[i][j];
+				sha1[i][j]=key[j<total?j:0]->osha1[i];
+			}
+			memset(bfr[j]+NEOSC_SHA1_SIZE,0,64-NEOSC_SHA1_SIZE);
+			bfr[j][NEOSC_SHA1_SIZE]=0x80;
+			bfr[j][62]=0x02;
+			bfr[j][63]=0xa0;
+			ptr[j]=bfr[j];
+		}
+		sha1blockmb(sha1,ptr);
+	}
+
+	for(j=0;j<total;j++)for(i=0;i<5;i++)
+	{
+		result[j][i<<2]=(unsigned char)(sha1[i][j]>>24);
+		result[j][(i<<2)+1]=(unsigned char)(sha1[i][j]>>16);
+		result[j][(i<<2)+2]=(unsigned char)(sha1[i][j]>>8);
+		result[j][(i<<2)+3]=(unsigned char)sha1[i][j];
+	}
+
+	memset(bfr,0,sizeof(bfr));
+	*(volatile char *)bfr=*(volatile char *)bfr;
+}
+
+#endif
+
+void neosc_sha1_mb(unsigned char **data,unsigned int length,
+	unsigned char **result,int total)
+{
+	int i;
+
+#ifdef __GNUC__
+	if(usemb)
+	{
+		for(i=0;i<total;i+=8)
+			sha1mb(data+i,length,result+i,NULL,total-i<8?total-i:8);
+		return;
+	}
+#endif
+	for(i=0;i<total;i++)neosc_sha1(data[i],length,result[i]);
+}
+
+void neosc_sha1hmac_mb(unsigned char **data,unsigned int length,
+	unsigned char **result,NEOSC_SHA1HMDATA **key,int total)
+{
+	int i;
+
+#ifdef __GNUC__
+	if(usemb)
+	{
+		for(i=0;i<total;i+=8)
+			sha1mb(data+i,length,result+i,key+i,total-i<8?total-i:8);
+		return;
+	}
+#endif
+	for(i=0;i<total;i++)neosc_sha1hmac(data[i],length,result[i],key[i]);
+}
+
+void neosc_sha1_iterate(NEOSC_SHA1HMDATA *key,unsigned int *u,
+	unsigned int *acc,int iterations)
+{
+	register int i;
+	unsigned int w[16];
+
+	for(;iterations>0;iterations--)
+	{
+		for(i=0;i<5;i++)w[i]=u[i];
+		w[5]=0x80000000;
+		for(i=6;i<15;i++)w[i]=0;
+		w[15]=(64+NEOSC_SHA1_SIZE)<<3;
+		for(i=0;i<5;i++)u[i]=key->isha1[i];
+		sha1wblock(u,w);
+
+		for(i=0;i<5;i++)w[i]=u[i];
+		w[5]=0x80000000;
+		for(i=6;i<15;i++)w[i]=0;
+		w[15]=(64+NEOSC_SHA1_SIZE)<<3;
+		for(i=0;i<5;i++)u[i]=key->osha1[i];
+		sha1wblock(u,w);
+
+		for(i=0;i<5;i++)acc[i]^=u[i];
+	}
+
+	for(i=0;i<16;i++)w[i]=0;
+	*(volatile unsigned int *)w=*(volatile unsigned int *)w;
+}
+
+void neosc_sha1_iterate_mb(NEOSC_SHA1HMDATA *key,unsigned int *u,
+	unsigned int *acc,int total,int iterations)
+{
+#ifdef __GNUC__
+	if(usemb)
+	{
+		iteratemb(key,u,acc,total,iterations);
+		return;
+	}
+#endif
+	for(;total>0;total--,u+=5,acc+=5)
+		neosc_sha1_iterate(key,u,acc,iterations);
 }
@@ -0,0 +1,456 @@
+/* 
+ * libneosc - an easy access library to the YubiKey NEO(-N)/4 (nano)
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#include <string.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define X86
+#endif
+#include "libneosc.h"
+#include "crypto.h"
+
+#define ror(a,n) (((a)>>(n))|((a)<<(32-(n))))
+#define S0(a) (ror(a,2)^ror(a,13)^ror(a,22))
+#define S1(a) (ror(a,6)^ror(a,11)^ror(a,25))
+#define s0(a) (ror(a,7)^ror(a,18)^((a)>>3))
+#define s1(a) (ror(a,17)^ror(a,19)^((a)>>10))
+#define CH(a,b,c) ((((b)^(c))&(a))^(c))
+#define MAJ(a,b,c) (((a)&(b))|(((a)|(b))&(c)))
+#define R(a,b,c,d,e,f,g,h,i) \
+	t=h+S1(e)+CH(e,f,g)+k256[i]+w[i]; \
+	d+=t; \
+	h=t+S0(a)+MAJ(a,b,c)
+
+static const unsigned int k256[64]=
+{
+	0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,
+	0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+	0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,
+	0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+	0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,
+	0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+	0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,
+	0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+	0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,
+	0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+	0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,
+	0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+	0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,
+	0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+	0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,
+	0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
+};
+
+static const unsigned int iv256[8]=
+{
+	0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,
+	0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19
+};
+
+static void sha256wblock_std(unsigned int *sha256,unsigned int *m)
+{
+	register int i;
+	register unsigned int a;
+	register unsigned int b;
+	register unsigned int c;
+	register unsigned int d;
+	register unsigned int e;
+	register unsigned int f;
+	register unsigned int g;
+	register unsigned int h;
+	register unsigned int t;
+	unsigned int w[64];
+
+	for(i=0;i<16;i++)w[i]=m[i];
+	for(;i<64;i++)w[i]=s1(w[i-2])+w[i-7]+s0(w[i-15])+w[i-16];
+
+	a=sha256[0];
+	b=sha256[1];
+	c=sha256[2];
+	d=sha256[3];
+	e=sha256[4];
+	f=sha256[5];
+	g=sha256[6];
+	h=sha256[7];
+
+	for(i=0;i<64;i+=8)
+	{
+		R(a,b,c,d,e,f,g,h,i);
+		R(h,a,b,c,d,e,f,g,i+1);
+		R(g,h,a,b,c,d,e,f,i+2);
+		R(f,g,h,a,b,c,d,e,i+3);
+		R(e,f,g,h,a,b,c,d,i+4);
+		R(d,e,f,g,h,a,b,c,i+5);
+		R(c,d,e,f,g,h,a,b,i+6);
+		R(b,c,d,e,f,g,h,a,i+7);
+	}
+
+	sha256[0]+=a;
+	sha256[1]+=b;
+	sha256[2]+=c;
+	sha256[3]+=d;
+	sha256[4]+=e;
+	sha256[5]+=f;
+	sha256[6]+=g;
+	sha256[7]+=h;
+}
+
+static void sha256block_std(unsigned int *sha256,unsigned char *data)
+{
+	register int i;
+	unsigned int w[16];
+
+	for(i=0;i<16;i++,data+=4)
+		w[i]=(data[0]<<24)|(data[1]<<16)|(data[2]<<8)|data[3];
+	sha256wblock_std(sha256,w);
+}
+
+#ifdef X86
+
+#define NIR(m,p,n,i) \
+	msg=_mm_add_epi32(m,_mm_loadu_si128((__m128i *)(k256+i))); \
+	s1=_mm_sha256rnds2_epu32(s1,s0,msg); \
+	n=_mm_add_epi32(n,_mm_alignr_epi8(m,p,4)); \
+	n=_mm_sha256msg2_epu32(n,m); \
+	msg=_mm_shuffle_epi32(msg,0x0e); \
+	s0=_mm_sha256rnds2_epu32(s0,s1,msg); \
+	p=_mm_sha256msg1_epu32(p,m)
+
+__attribute__((target("sha,ssse3,sse4.1"))) static inline
+	__attribute__((always_inline)) void sha256ni(unsigned int *sha256,
+	__m128i m0,__m128i m1,__m128i m2,__m128i m3)
+{
+	__m128i s0;
+	__m128i s1;
+	__m128i save0;
+	__m128i save1;
+	__m128i msg;
+	__m128i tmp;
+
+	tmp=_mm_shuffle_epi32(_mm_loadu_si128((__m128i *)sha256),0xb1);
+	s1=_mm_shuffle_epi32(_mm_loadu_si128((__m128i *)(sha256+4)),0x1b);
+	s0=_mm_alignr_epi8(tmp,s1,8);
+	s1=_mm_blend_epi16(s1,tmp,0xf0);
+	save0=s0;
+	save1=s1;
+
+	msg=_mm_add_epi32(m0,_mm_loadu_si128((__m128i *)k256));
+	s1=_mm_sha256rnds2_epu32(s1,s0,msg);
+	msg=_mm_shuffle_epi32(msg,0x0e);
+	s0=_mm_sha256rnds2_epu32(s0,s1,msg);
+
+	msg=_mm_add_epi32(m1,_mm_loadu_si128((__m128i *)(k256+4)));
+	s1=_mm_sha256rnds2_epu32(s1,s0,msg);
+	msg=_mm_shuffle_epi32(msg,0x0e);
+	s0=_mm_sha256rnds2_epu32(s0,s1,msg);
+	m0=_mm_sha256msg1_epu32(m0,m1);
+
+	msg=_mm_add_epi32(m2,_mm_loadu_si128((__m128i *)(k256+8)));
+	s1=_mm_sha256rnds2_epu32(s1,s0,msg);
+	msg=_mm_shuffle_epi32(msg,0x0e);
+	s0=_mm_sha256rnds2_epu32(s0,s1,msg);
+	m1=_mm_sha256msg1_epu32(m1,m2);
+
+	NIR(m3,m2,m0,12);
+	NIR(m0,m3,m1,16);
+	NIR(m1,m0,m2,20);
+	NIR(m2,m1,m3,24);
+	NIR(m3,m2,m0,28);
+	NIR(m0,m3,m1,32);
+	NIR(m1,m0,m2,36);
+	NIR(m2,m1,m3,40);
+	NIR(m3,m2,m0,44);
+	NIR(m0,m3,m1,48);
+
+	msg=_mm_add_epi32(m1,_mm_loadu_si128((__m128i *)(k256+52)));
+	s1=_mm_sha256rnds2_epu32(s1,s0,msg);
+	m2=_mm_add_epi32(m2,_mm_alignr_epi8(m1,m0,4));
+	m2=_mm_sha256msg2_epu32(m2,m1);
+	msg=_mm_shuffle_epi32(msg,0x0e);
+	s0=_mm_sha256rnds2_epu32(s0,s1,msg);
+
+	msg=_mm_add_epi32(m2,_mm_loadu_si128((__m128i *)(k256+56)));
+	s1=_mm_sha256rnds2_epu32(s1,s0,msg);
+	m3=_mm_add_epi32(m3,_mm_alignr_epi8(m2,m1,4));
+	m3=_mm_sha256msg2_epu32(m3,m2);
+	msg=_mm_shuffle_epi32(msg,0x0e);
+	s0=_mm_sha256rnds2_epu32(s0,s1,msg);
+
+	msg=_mm_add_epi32(m3,_mm_loadu_si128((__m128i *)(k256+60)));
+	s1=_mm_sha256rnds2_epu32(s1,s0,msg);
+	msg=_mm_shuffle_epi32(msg,0x0e);
+	s0=_mm_sha256rnds2_epu32(s0,s1,msg);
+
+	s0=_mm_add_epi32(s0,save0);
+	s1=_mm_add_epi32(s1,save1);
+
+	tmp=_mm_shuffle_epi32(s0,0x1b);
+	s1=_mm_shuffle_epi32(s1,0xb1);
+	_mm_storeu_si128((__m128i *)sha256,_mm_blend_epi16(tmp,s1,0xf0));
+	_mm_storeu_si128((__m128i *)(sha256+4),_mm_alignr_epi8(s1,tmp,8));
+}
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void sha256block_ni(unsigned int *sha256,unsigned char *data)
+{
+	__m128i mask;
+
+	mask=_mm_set_epi64x(0x0c0d0e0f08090a0bULL,0x0405060700010203ULL);
+
+	sha256ni(sha256,
+		_mm_shuffle_epi8(_mm_loadu_si128((__m128i *)data),mask),
+		_mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(data+16)),mask),
+		_mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(data+32)),mask),
+		_mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(data+48)),mask));
+}
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void sha256wblock_ni(unsigned int *sha256,unsigned int *w)
+{
+	sha256ni(sha256,_mm_loadu_si128((__m128i *)w),
+		_mm_loadu_si128((__m128i *)(w+4)),
+		_mm_loadu_si128((__m128i *)(w+8)),
+		_mm_loadu_si128((__m128i *)(w+12)));
+}
+
+#endif
+
+static void (*sha256block)(unsigned int *sha256,unsigned char *data)=
+	sha256block_std;
+static void (*sha256wblock)(unsigned int *sha256,unsigned int *w)=
+	sha256wblock_std;
+
+int neosc_sha256_select(int mask)
+{
+	int r=0;
+
+	sha256block=sha256block_std;
+	sha256wblock=sha256wblock_std;
+#ifdef X86
+	__builtin_cpu_init();
+	if((mask&NEOSC_CPU_SHANI)&&__builtin_cpu_supports("sha")&&
+		__builtin_cpu_supports("sse4.1"))
+	{
+		sha256block=sha256block_ni;
+		sha256wblock=sha256wblock_ni;
+		r|=NEOSC_CPU_SHANI;
+	}
+#endif
+	return r;
+}
+
+#ifdef X86
+
+__attribute__((constructor)) static void sha256setup(void)
+{
+	neosc_sha256_select(NEOSC_CPU_SHANI);
+}
+
+#endif
+
+static inline void putbe(unsigned char *dst,unsigned int val)
+{
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	val=__builtin_bswap32(val);
+	memcpy(dst,&val,4);
+#elif defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	memcpy(dst,&val,4);
+#else
+	dst[0]=(unsigned char)(val>>24);
+	dst[1]=(unsigned char)(val>>16);
+	dst[2]=(unsigned char)(val>>8);
+	dst[3]=(unsigned char)val;
+#endif
+}
+
+static void result256(unsigned char *result,unsigned int *sha256)
+{
+	register int i;
+
+	for(i=0;i<8;i++,result+=4)putbe(result,sha256[i]);
+}
+
+static void sha256pad(unsigned int *sha256,unsigned char *bfr,
+	unsigned int size,unsigned long long total)
+{
+	bfr[size++]=0x80;
+	if(size>56)
+	{
+		memset(bfr+size,0,64-size);
+		sha256block(sha256,bfr);
+		size=0;
+	}
+	memset(bfr+size,0,56-size);
+	putbe(bfr+56,(unsigned int)(total>>29));
+	putbe(bfr+60,(unsigned int)(total<<3));
+	sha256block(sha256,bfr);
+}
+
+static void sha256outer(unsigned char *result,unsigned int *inner,
+	NEOSC_SHA256HMDATA *key)
+{
+	register int i;
+	unsigned int w[16];
+	unsigned int sha256[8];
+
+	for(i=0;i<8;i++)
+	{
+		w[i]=inner[i];
+		sha256[i]=key->osha256[i];
+	}
+	w[8]=0x80000000;
+	for(i=9;i<15;i++)w[i]=0;
+	w[15]=(64+NEOSC_SHA256_SIZE)<<3;
+	sha256wblock(sha256,w);
+	result256(result,sha256);
+}
+
+void neosc_sha256init(register NEOSC_SHA256DATA *ptr)
+{
+	ptr->total=ptr->size=0;
+	memcpy(ptr->sha256,iv256,sizeof(iv256));
+}
+
+void neosc_sha256next(register unsigned char *data,register unsigned int length,
+	register NEOSC_SHA256DATA *ptr)
+{
+	register unsigned int i=ptr->size;
+
+	ptr->total+=length;
+
+	if(i)
+	{
+		if(length<64-i)
+		{
+			memcpy(ptr->bfr.b+i,data,length);
+			ptr->size=(unsigned char)(i+length);
+			return;
+		}
+		memcpy(ptr->bfr.b+i,data,64-i);
+		sha256block(ptr->sha256,ptr->bfr.b);
+		data+=64-i;
+		length-=64-i;
+	}
+
+	for(;length>63;length-=64,data+=64)sha256block(ptr->sha256,data);
+	memcpy(ptr->bfr.b,data,length);
+	ptr->size=(unsigned char)(length);
+}
+
+void neosc_sha256end(register unsigned char *result,
+	register NEOSC_SHA256DATA *ptr)
+{
+	sha256pad(ptr->sha256,ptr->bfr.b,ptr->size,ptr->total);
+	result256(result,ptr->sha256);
+}
+
+void neosc_sha256(register unsigned char *data,register unsigned int length,
+	unsigned char *result)
+{
+	NEOSC_SHA256DATA sha256data;
+
+	neosc_sha256init(&sha256data);
+	neosc_sha256next(data,length,&sha256data);
+	neosc_sha256end(result,&sha256data);
+}
+
+void neosc_sha256hmkey(unsigned char *key,unsigned int keylength,
+	NEOSC_SHA256HMDATA *ptr)
+{
+	register unsigned int i;
+	NEOSC_SHA256(hash);
+	unsigned char pad[64];
+
+	if(keylength>64)
+	{
+		neosc_sha256(key,keylength,hash);
+		key=hash;
+		keylength=NEOSC_SHA256_SIZE;
+	}
+
+	memcpy(ptr->isha256,iv256,sizeof(iv256));
+	memcpy(ptr->osha256,iv256,sizeof(iv256));
+
+	for(i=0;i<keylength;i++)pad[i]=key[i]^0x36;
+	for(;i<64;i++)pad[i]=0x36;
+	sha256block(ptr->isha256,pad);
+
+	for(i=0;i<keylength;i++)pad[i]=key[i]^0x5c;
+	for(;i<64;i++)pad[i]=0x5c;
+	sha256block(ptr->osha256,pad);
+
+	memset(hash,0,sizeof(hash));
+	memset(pad,0,sizeof(pad));
+	*(volatile char *)pad=*(volatile char *)pad;
+}
+
+void neosc_sha256hminit(NEOSC_SHA256DATA *ptr,NEOSC_SHA256HMDATA *key)
+{
+	ptr->total=64;
+	ptr->size=0;
+	memcpy(ptr->sha256,key->isha256,sizeof(ptr->sha256));
+}
+
+void neosc_sha256hmend(unsigned char *result,NEOSC_SHA256DATA *ptr,
+	NEOSC_SHA256HMDATA *key)
+{
+	sha256pad(ptr->sha256,ptr->bfr.b,ptr->size,ptr->total);
+	sha256outer(result,ptr->sha256,key);
+}
+
+void neosc_sha256hmac(unsigned char *data,unsigned int length,
+	unsigned char *result,NEOSC_SHA256HMDATA *key)
+{
+	NEOSC_SHA256DATA sha256data;
+
+	neosc_sha256hminit(&sha256data,key);
+	neosc_sha256next(data,length,&sha256data);
+	neosc_sha256hmend(result,&sha256data,key);
+}
+
+void neosc_sha256_iterate(NEOSC_SHA256HMDATA *key,unsigned int *u,
+	unsigned int *acc,int iterations)
+{
+	register int i;
+	unsigned int w[16];
+
+	for(;iterations>0;iterations--)
+	{
+		for(i=0;i<8;i++)w[i]=u[i];
+		w[8]=0x80000000;
+		for(i=9;i<15;i++)w[i]=0;
+		w[15]=(64+NEOSC_SHA256_SIZE)<<3;
+		for(i=0;i<8;i++)u[i]=key->isha256[i];
+		sha256wblock(u,w);
+
+		for(i=0;i<8;i++)w[i]=u[i];
+		w[8]=0x80000000;
+		for(i=9;i<15;i++)w[i]=0;
+		w[15]=(64+NEOSC_SHA256_SIZE)<<3;
+		for(i=0;i<8;i++)u[i]=key->osha256[i];
+		sha256wblock(u,w);
+
+		for(i=0;i<8;i++)acc[i]^=u[i];
+	}
+
+	for(i=0;i<16;i++)w[i]=0;
+	*(volatile unsigned int *)w=*(volatile unsigned int *)w;
+}
@@ -0,0 +1,378 @@
+/* 
+ * libneosc - an easy access library to the YubiKey NEO(-N)/4 (nano)
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+/*
+ * Known answer tests and timing for the hash code. Every vector is run
+ * on each hash implementation the CPU supports, the portable code is
+ * always tested. Call with -t to print timings instead.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "libneosc.h"
+#include "crypto.h"
+
+#define MBTOTAL		11
+#define MBLEN		200
+#define ROUNDS		1000000
+
+#define B10(a)	a a a a a a a a a a
+#define AA80	B10("\xaa") B10("\xaa") B10("\xaa") B10("\xaa") \
+		B10("\xaa") B10("\xaa") B10("\xaa") B10("\xaa")
+#define AA131	AA80 B10("\xaa") B10("\xaa") B10("\xaa") B10("\xaa") \
+		B10("\xaa") "\xaa"
+
+typedef struct
+{
+	char *key;
+	int klen;
+	char *data;
+	int dlen;
+	int repeat;
+	char *digest;
+} VECTOR;
+
+typedef struct
+{
+	char *pass;
+	char *salt;
+	int slen;
+	int iterations;
+	int olen;
+	char *digest;
+} KDFVECTOR;
+
+static struct
+{
+	int mask;
+	char *name;
+} path[]=
+{
+	{0,"portable"},
+	{NEOSC_CPU_SHANI,"sha-ni"},
+	{NEOSC_CPU_AVX2,"avx2"},
+	{NEOSC_CPU_SHANI|NEOSC_CPU_AVX2,"sha-ni+avx2"},
+	{-1,NULL}
+};
+
+/* FIPS 180-2 appendix A */
+
+static VECTOR sha1vec[]=
+{
+	{NULL,0,"abc",3,1,"a9993e364706816aba3e25717850c26c9cd0d89d"},
+	{NULL,0,"",0,1,"da39a3ee5e6b4b0d3255bfef95601890afd80709"},
+	{NULL,0,"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",56,1,
+		"84983e441c3bd26ebaae4aa1f95129e5e54670f1"},
+	{NULL,0,B10("a"),10,100000,"34aa973cd4c4daa4f61eeb2bdbad27316534016f"},
+	{NULL,0,NULL,0,0,NULL}
+};
+
+/* RFC 2202 */
+
+static VECTOR sha1hmvec[]=
+{
+	{B10("\x0b") B10("\x0b"),20,"Hi There",8,1,
+		"b617318655057264e28bc0b6fb378c8ef146be00"},
+	{"Jefe",4,"what do ya want for nothing?",28,1,
+		"effcdf6ae5eb2fa2d27416d5f184df9c259a7c79"},
+	{AA80,80,"Test Using Larger Than Block-Size Key - Hash Key First",54,1,
+		"aa4ae5e15272d00e95705637ce8a3b55ed402112"},
+	{NULL,0,NULL,0,0,NULL}
+};
+
+/* RFC 6070 */
+
+static KDFVECTOR sha1kdfvec[]=
+{
+	{"password","salt",4,1,20,"0c60c80f961f0e71f3a9b524af6012062fe037a6"},
+	{"password","salt",4,2,20,"ea6c014dc72d6f8ccd1ed92ace1d41f0d8de8957"},
+	{"password","salt",4,4096,20,
+		"4b007901b765489abead49d926f721d065a429c1"},
+	{"passwordPASSWORDpassword","saltSALTsaltSALTsaltSALTsaltSALTsalt",36,
+		4096,25,"3d2eec4fe41c849b80c8d83662c0e44a8b291a964cf2f07038"},
+	{NULL,NULL,0,0,0,NULL}
+};
+
+/* FIPS 180-2 appendix B */
+
+static VECTOR sha256vec[]=
+{
+	{NULL,0,"abc",3,1,
+	 "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+	{NULL,0,"",0,1,
+	 "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+	{NULL,0,"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",56,1,
+	 "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+	{NULL,0,B10("a"),10,100000,
+	 "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+	{NULL,0,NULL,0,0,NULL}
+};
+
+/* RFC 4231 */
+
+static VECTOR sha256hmvec[]=
+{
+	{B10("\x0b") B10("\x0b"),20,"Hi There",8,1,
+	 "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7"},
+	{"Jefe",4,"what do ya want for nothing?",28,1,
+	 "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"},
+	{AA131,131,"Test Using Larger Than Block-Size Key - Hash Key First",54,1,
+	 "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54"},
+	{NULL,0,NULL,0,0,NULL}
+};
+
+/* RFC 6070 parameters with HMAC-SHA256 */
+
+static KDFVECTOR sha256kdfvec[]=
+{
+	{"password","salt",4,1,32,
+	 "120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b"},
+	{"password","salt",4,4096,32,
+	 "c5e478d59288c841aa530db6845c4c8d962893a001ce4e11a4963873aa98134a"},
+	{NULL,NULL,0,0,0,NULL}
+};
+
+static int fail=0;
+
+static void check(char *what,char *name,int idx,unsigned char *md,int len,
+	char *digest)
+{
+	int i;
+	char bfr[2*NEOSC_SHA256_SIZE+1];
+
+	for(i=0;i<len;i++)sprintf(bfr+2*i,"%02x",md[i]);
+	if(!strcmp(bfr,digest))return;
+	printf("FAIL %s %s vector %d: %s\n",what,name,idx,bfr);
+	fail=1;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec*1e9+ts.tv_nsec;
+}
+
+static void sha1_vectors(char *name)
+{
+	int i;
+	int j;
+	VECTOR *v;
+	KDFVECTOR *k;
+	NEOSC_SHA1DATA ctx;
+	NEOSC_SHA1HMDATA key;
+	NEOSC_SHA1HMDATA *keys[MBTOTAL];
+	NEOSC_SHA1(md);
+	unsigned char *in[MBTOTAL];
+	unsigned char *out[MBTOTAL];
+	unsigned char msg[MBTOTAL][MBLEN];
+	unsigned char res[MBTOTAL][NEOSC_SHA1_SIZE];
+	unsigned char kdf[32];
+
+	for(i=0;i<MBTOTAL;i++)
+	{
+		keys[i]=&key;
+		out[i]=res[i];
+	}
+
+	for(i=0,v=sha1vec;v->data;i++,v++)
+	{
+		neosc_sha1init(&ctx);
+		for(j=0;j<v->repeat;j++)
+			neosc_sha1next((unsigned char *)v->data,v->dlen,&ctx);
+		neosc_sha1end(md,&ctx);
+		check("sha1",name,i,md,NEOSC_SHA1_SIZE,v->digest);
+		if(v->repeat!=1)continue;
+		neosc_sha1((unsigned char *)v->data,v->dlen,md);
+		check("sha1",name,i,md,NEOSC_SHA1_SIZE,v->digest);
+		for(j=0;j<MBTOTAL;j++)in[j]=(unsigned char *)v->data;
+		neosc_sha1_mb(in,v->dlen,out,MBTOTAL);
+		for(j=0;j<MBTOTAL;j++)
+			check("sha1_mb",name,i,res[j],NEOSC_SHA1_SIZE,v->digest);
+	}
+
+	for(i=0,v=sha1hmvec;v->data;i++,v++)
+	{
+		neosc_sha1hmkey((unsigned char *)v->key,v->klen,&key);
+		neosc_sha1hmac((unsigned char *)v->data,v->dlen,md,&key);
+		check("sha1hmac",name,i,md,NEOSC_SHA1_SIZE,v->digest);
+		for(j=0;j<MBTOTAL;j++)in[j]=(unsigned char *)v->data;
+		neosc_sha1hmac_mb(in,v->dlen,out,keys,MBTOTAL);
+		for(j=0;j<MBTOTAL;j++)check("sha1hmac_mb",name,i,res[j],
+			NEOSC_SHA1_SIZE,v->digest);
+	}
+
+	for(i=0,k=sha1kdfvec;k->pass;i++,k++)
+	{
+		neosc_pbkdf2(k->pass,(unsigned char *)k->salt,k->slen,
+			k->iterations,kdf,k->olen);
+		check("pbkdf2",name,i,kdf,k->olen,k->digest);
+	}
+
+	for(i=0;i<MBTOTAL;i++)
+	{
+		for(j=0;j<MBLEN;j++)msg[i][j]=(unsigned char)(i*31+j);
+		in[i]=msg[i];
+	}
+	neosc_sha1_mb(in,MBLEN,out,MBTOTAL);
+	for(i=0;i<MBTOTAL;i++)
+	{
+		neosc_sha1(msg[i],MBLEN,md);
+		if(memcmp(md,res[i],NEOSC_SHA1_SIZE))
+		{
+			printf("FAIL sha1_mb %s lane %d\n",name,i);
+			fail=1;
+		}
+	}
+}
+
+static void sha256_vectors(char *name)
+{
+	int i;
+	int j;
+	VECTOR *v;
+	KDFVECTOR *k;
+	NEOSC_SHA256DATA ctx;
+	NEOSC_SHA256HMDATA key;
+	NEOSC_SHA256(md);
+
+	for(i=0,v=sha256vec;v->data;i++,v++)
+	{
+		neosc_sha256init(&ctx);
+		for(j=0;j<v->repeat;j++)
+			neosc_sha256next((unsigned char *)v->data,v->dlen,&ctx);
+		neosc_sha256end(md,&ctx);
+		check("sha256",name,i,md,NEOSC_SHA256_SIZE,v->digest);
+		if(v->repeat!=1)continue;
+		neosc_sha256((unsigned char *)v->data,v->dlen,md);
+		check("sha256",name,i,md,NEOSC_SHA256_SIZE,v->digest);
+	}
+
+	for(i=0,v=sha256hmvec;v->data;i++,v++)
+	{
+		neosc_sha256hmkey((unsigned char *)v->key,v->klen,&key);
+		neosc_sha256hmac((unsigned char *)v->data,v->dlen,md,&key);
+		check("sha256hmac",name,i,md,NEOSC_SHA256_SIZE,v->digest);
+	}
+
+	for(i=0,k=sha256kdfvec;k->pass;i++,k++)
+	{
+		neosc_pbkdf2_sha256(k->pass,(unsigned char *)k->salt,k->slen,
+			k->iterations,md,k->olen);
+		check("pbkdf2_sha256",name,i,md,k->olen,k->digest);
+	}
+}
+
+static void sha1_timing(char *name)
+{
+	int i;
+	double t;
+	NEOSC_SHA1(md);
+	unsigned char *in[NEOSC_SHA1_LANES];
+	unsigned char *out[NEOSC_SHA1_LANES];
+	unsigned char msg[NEOSC_SHA1_LANES][64];
+	unsigned char res[NEOSC_SHA1_LANES][NEOSC_SHA1_SIZE];
+
+	memset(msg,0x5a,sizeof(msg));
+	for(i=0;i<NEOSC_SHA1_LANES;i++)
+	{
+		in[i]=msg[i];
+		out[i]=res[i];
+	}
+
+	t=now();
+	for(i=0;i<ROUNDS;i++)neosc_sha1(msg[0],64,md);
+	printf("%-12s sha1 64 bytes     %8.1f ns/msg\n",name,(now()-t)/ROUNDS);
+
+	t=now();
+	for(i=0;i<ROUNDS;i+=NEOSC_SHA1_LANES)
+		neosc_sha1_mb(in,64,out,NEOSC_SHA1_LANES);
+	printf("%-12s sha1_mb 64 bytes  %8.1f ns/msg\n",name,(now()-t)/ROUNDS);
+
+	t=now();
+	neosc_pbkdf2("password",msg[0],8,ROUNDS,md,NEOSC_SHA1_SIZE);
+	printf("%-12s pbkdf2            %8.1f ns/iteration\n",name,
+		(now()-t)/ROUNDS);
+}
+
+static void sha256_timing(char *name)
+{
+	int i;
+	double t;
+	NEOSC_SHA256(md);
+	unsigned char msg[64];
+
+	memset(msg,0x5a,sizeof(msg));
+
+	t=now();
+	for(i=0;i<ROUNDS;i++)neosc_sha256(msg,64,md);
+	printf("%-12s sha256 64 bytes   %8.1f ns/msg\n",name,(now()-t)/ROUNDS);
+
+	t=now();
+	neosc_pbkdf2_sha256("password",msg,8,ROUNDS,md,NEOSC_SHA256_SIZE);
+	printf("%-12s pbkdf2_sha256     %8.1f ns/iteration\n",name,
+		(now()-t)/ROUNDS);
+}
+
+int main(int argc,char *argv[])
+{
+	int i;
+	int timing=0;
+
+	if(argc==2&&!strcmp(argv[1],"-t"))timing=1;
+	else if(argc!=1)
+	{
+		fprintf(stderr,"Usage: %s [-t]\n",argv[0]);
+		return 1;
+	}
+
+	for(i=0;path[i].name;i++)
+	{
+		if(neosc_sha1_select(path[i].mask)!=path[i].mask)
+		{
+			printf("%-12s not supported by this CPU\n",path[i].name);
+			continue;
+		}
+		if(timing)sha1_timing(path[i].name);
+		else
+		{
+			sha1_vectors(path[i].name);
+			printf("%-12s sha1 tested\n",path[i].name);
+		}
+
+		if(path[i].mask&NEOSC_CPU_AVX2)continue;
+		neosc_sha256_select(path[i].mask);
+		if(timing)sha256_timing(path[i].name);
+		else
+		{
+			sha256_vectors(path[i].name);
+			printf("%-12s sha256 tested\n",path[i].name);
+		}
+	}
+
+	neosc_sha1_select(NEOSC_CPU_SHANI|NEOSC_CPU_AVX2);
+	neosc_sha256_select(NEOSC_CPU_SHANI);
+
+	if(fail)printf("FAILED\n");
+	return fail;
+}
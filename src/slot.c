@@ -0,0 +1,215 @@
+/* 
+ * libneosc - an easy access library to the YubiKey NEO(-N)/4 (nano)
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include "libneosc.h"
+
+#define CMD_CONFIG	0
+#define CMD_UPDATE	1
+#define CMD_SWAP	2
+#define CMD_RAW		3
+
+#define FIX_NONE	0
+#define FIX_PUBID	1
+#define FIX_HOTP	2
+
+#define UID_NONE	0
+#define UID_AES		1
+#define UID_HOTP	2
+#define UID_PRIVID	3
+#define UID_PRIVREQ	4
+#define UID_RAW		5
+
+static struct
+{
+	int cmd;
+	int fixed;
+	int uid;
+	int aeslen;
+	int tktmask;
+	int tktset;
+	int cfgmask;
+	int cfgset;
+} slottab[]=
+{
+	{CMD_RAW,FIX_PUBID,UID_RAW,16,0xff,0x00,0xff,0x00},	/* raw */
+	{CMD_SWAP,FIX_NONE,UID_NONE,0,0x00,0x00,0x00,0x00},	/* swap */
+	{CMD_UPDATE,FIX_NONE,UID_NONE,0,0x3f,0x00,0x0c,0x00},	/* update */
+	{CMD_CONFIG,FIX_NONE,UID_AES,20,0x80,0x40,0x0c,0x22},	/* hmac */
+	{CMD_CONFIG,FIX_NONE,UID_PRIVID,16,0x80,0x40,0x08,0x20},/* otp */
+	{CMD_CONFIG,FIX_HOTP,UID_HOTP,20,0xbf,0x40,0x5f,0x00},	/* hotp */
+	{CMD_CONFIG,FIX_PUBID,UID_PRIVID,16,0xbf,0x00,0x0d,0x00},/* yubiotp */
+	{CMD_CONFIG,FIX_PUBID,UID_PRIVREQ,16,0xbf,0x00,0xdf,0x20},/* passwd */
+};
+
+static unsigned short crc16(unsigned char *ptr,int len)
+{
+	int i;
+	unsigned short crc=0xffff;
+
+	while(len--)
+	{
+		crc^=*ptr++;
+		for(i=0;i<8;i++)if(crc&1)crc=(crc>>1)^0x8408;
+		else crc>>=1;
+	}
+	return crc;
+}
+
+static int check(NEOSC_SLOT_CONFIG *cfg)
+{
+	int i;
+
+	if(cfg->type<NEOSC_SLOT_RAW||cfg->type>NEOSC_SLOT_PASSWD)return -1;
+	i=cfg->type;
+
+	if(cfg->code&&cfg->codelen!=6)return -1;
+	if(cfg->newcode&&cfg->newlen!=6)return -1;
+	if((cfg->tktflags&~slottab[i].tktmask)||
+		(cfg->cfgflags&~slottab[i].cfgmask)||
+		(cfg->extflags&~(slottab[i].cmd==CMD_SWAP?0x00:0xff)))return -1;
+
+	switch(slottab[i].cmd)
+	{
+	case CMD_RAW:
+		if(cfg->command<0||cfg->command>255)return -1;
+		if(cfg->aesdata&&cfg->aeslen!=16)return -1;
+		if(cfg->privid&&cfg->privlen!=4&&cfg->privlen!=6)return -1;
+		break;
+
+	case CMD_CONFIG:
+		if(!cfg->aesdata||cfg->aeslen!=slottab[i].aeslen)return -1;
+	case CMD_UPDATE:
+		if(cfg->slot^(cfg->slot&1))return -1;
+		if((cfg->extflags&0x60)==0x40)return -1;
+		break;
+	}
+
+	switch(slottab[i].fixed)
+	{
+	case FIX_PUBID:
+		if(cfg->pubid&&(cfg->publen<0||cfg->publen>16))return -1;
+		break;
+
+	case FIX_HOTP:
+		if(cfg->omp<0||cfg->omp>255||cfg->tt<0||cfg->tt>255||
+			cfg->mui<-1||cfg->mui>99999999)return -1;
+		if(cfg->mui<0&&(cfg->cfgflags&0x50))return -1;
+		break;
+	}
+
+	switch(slottab[i].uid)
+	{
+	case UID_HOTP:
+		if(cfg->imf<0||cfg->imf>0xffff0||(cfg->imf&0xf))return -1;
+		break;
+
+	case UID_PRIVREQ:
+		if(!cfg->privid)return -1;
+	case UID_PRIVID:
+		if(cfg->privid&&cfg->privlen!=6)return -1;
+		break;
+	}
+
+	if(cfg->type==NEOSC_SLOT_PASSWD)
+	{
+		if(cfg->pubid&&cfg->publen<=0)return -1;
+		if((cfg->cfgflags&0x02)&&cfg->pubid)return -1;
+		if((cfg->cfgflags&0x41)==0x01)return -1;
+	}
+
+	return 0;
+}
+
+int neosc_slot_encode(NEOSC_SLOT_CONFIG *cfg,int *command,unsigned char *out)
+{
+	int i;
+	int mui;
+	unsigned short crc;
+
+	if(!cfg||!command||!out||check(cfg))return -1;
+	i=cfg->type;
+
+	memset(out,0,NEOSC_SLOT_SIZE);
+
+	switch(slottab[i].fixed)
+	{
+	case FIX_PUBID:
+		if(!cfg->pubid)break;
+		memcpy(out,cfg->pubid,cfg->publen);
+		out[44]=(unsigned char)cfg->publen;
+		break;
+
+	case FIX_HOTP:
+		if((mui=cfg->mui)<0)break;
+		out[0]=(unsigned char)cfg->omp;
+		out[1]=(unsigned char)cfg->tt;
+		out[2]=(unsigned char)(((mui/10000000)<<4)|((mui/1000000)%10));
+		out[3]=(unsigned char)((((mui/100000)%10)<<4)|((mui/10000)%10));
+		out[4]=(unsigned char)((((mui/1000)%10)<<4)|((mui/100)%10));
+		out[5]=(unsigned char)((((mui/10)%10)<<4)|(mui%10));
+		out[44]=6;
+		break;
+	}
+
+	switch(slottab[i].uid)
+	{
+	case UID_HOTP:
+		out[20]=(unsigned char)(cfg->imf>>12);
+		out[21]=(unsigned char)(cfg->imf>>4);
+	case UID_AES:
+		memcpy(out+16,cfg->aesdata+16,4);
+		break;
+
+	case UID_PRIVID:
+	case UID_PRIVREQ:
+	case UID_RAW:
+		if(cfg->privid)memcpy(out+16,cfg->privid,cfg->privlen);
+		break;
+	}
+
+	if(slottab[i].aeslen&&cfg->aesdata)memcpy(out+22,cfg->aesdata,16);
+	if(cfg->newcode)memcpy(out+38,cfg->newcode,6);
+	out[45]=(unsigned char)cfg->extflags;
+	out[46]=(unsigned char)(cfg->tktflags|slottab[i].tktset);
+	out[47]=(unsigned char)(cfg->cfgflags|slottab[i].cfgset);
+	crc=~crc16(out,50);
+	out[50]=(unsigned char)crc;
+	out[51]=(unsigned char)(crc>>8);
+	if(cfg->code)memcpy(out+52,cfg->code,6);
+
+	switch(slottab[i].cmd)
+	{
+	case CMD_CONFIG:
+		*command=cfg->slot?0x03:0x01;
+		break;
+	case CMD_UPDATE:
+		*command=cfg->slot?0x05:0x04;
+		break;
+	case CMD_SWAP:
+		*command=0x06;
+		break;
+	default:*command=cfg->command;
+		break;
+	}
+
+	return 0;
+}
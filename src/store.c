@@ -0,0 +1,396 @@
+/* 
+ * libneosc - an easy access library to the YubiKey NEO(-N)/4 (nano)
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "libneosc.h"
+
+#define memclear(a,b,c) \
+    do { memset(a,b,c); *(volatile char*)(a)=*(volatile char*)(a); } while(0)
+
+#define REC_MARK	0xa5
+#define REC_SIZE	48
+#define MAX_STRIPES	4096
+
+typedef struct
+{
+	int used;
+	int klen;
+	unsigned int hash;
+	long long value;
+	unsigned char key[NEOSC_STORE_KEYLEN];
+} ENTRY;
+
+typedef struct
+{
+	pthread_mutex_t mtx;
+	unsigned int size;
+	unsigned int total;
+	ENTRY *tab;
+} STRIPE;
+
+typedef struct
+{
+	pthread_rwlock_t jrnl;
+	char *file;
+	int fd;
+	int flags;
+	unsigned int mask;
+	unsigned int shift;
+	STRIPE *stripe;
+} STORE;
+
+static unsigned int hash(unsigned char *key,int klen)
+{
+	unsigned int h=0x811c9dc5;
+
+	while(klen--)h=(h^*key++)*0x01000193;
+	h^=h>>16;
+	h*=0x7feb352d;
+	h^=h>>15;
+	return h;
+}
+
+static ENTRY *find(STRIPE *s,unsigned int h,unsigned char *key,int klen)
+{
+	unsigned int i;
+	unsigned int mask=s->size-1;
+
+	for(i=h&mask;s->tab[i].used;i=(i+1)&mask)if(s->tab[i].hash==h&&
+		s->tab[i].klen==klen&&!memcmp(s->tab[i].key,key,klen))
+		return &s->tab[i];
+	return NULL;
+}
+
+static int grow(STRIPE *s)
+{
+	unsigned int i;
+	unsigned int j;
+	unsigned int size;
+	ENTRY *tab;
+
+	if((s->total+1)<<1<=s->size)return 0;
+
+	size=s->size<<1;
+	if(!(tab=calloc(size,sizeof(ENTRY))))return -1;
+	for(i=0;i<s->size;i++)if(s->tab[i].used)
+	{
+		for(j=s->tab[i].hash&(size-1);tab[j].used;j=(j+1)&(size-1));
+		tab[j]=s->tab[i];
+	}
+	memclear(s->tab,0,s->size*sizeof(ENTRY));
+	free(s->tab);
+	s->tab=tab;
+	s->size=size;
+	return 0;
+}
+
+static ENTRY *insert(STRIPE *s,unsigned int h,unsigned char *key,int klen)
+{
+	unsigned int i;
+
+	if(grow(s))return NULL;
+
+	for(i=h&(s->size-1);s->tab[i].used;i=(i+1)&(s->size-1));
+	s->tab[i].used=1;
+	s->tab[i].klen=klen;
+	s->tab[i].hash=h;
+	memcpy(s->tab[i].key,key,klen);
+	s->total++;
+	return &s->tab[i];
+}
+
+static void encode(unsigned char *rec,unsigned char *key,int klen,
+	long long value)
+{
+	int i;
+	unsigned int h;
+
+	memset(rec,0,REC_SIZE);
+	rec[0]=REC_MARK;
+	rec[1]=(unsigned char)klen;
+	memcpy(rec+2,key,klen);
+	for(i=0;i<8;i++)rec[34+i]=(unsigned char)(value>>(i<<3));
+	h=hash(rec,42);
+	for(i=0;i<4;i++)rec[42+i]=(unsigned char)(h>>(i<<3));
+}
+
+static int decode(unsigned char *rec,int *klen,long long *value)
+{
+	int i;
+	unsigned int h;
+	unsigned long long v;
+
+	if(rec[0]!=REC_MARK||rec[1]>NEOSC_STORE_KEYLEN)return -1;
+	for(h=0,i=3;i>=0;i--)h=(h<<8)|rec[42+i];
+	if(h!=hash(rec,42))return -1;
+	*klen=rec[1];
+	for(v=0,i=7;i>=0;i--)v=(v<<8)|rec[34+i];
+	*value=(long long)v;
+	return 0;
+}
+
+static int append(STORE *st,unsigned char *rec,int len)
+{
+	int l;
+
+	for(;len;len-=l,rec+=l)if((l=write(st->fd,rec,len))<=0)
+	{
+		if(l==-1&&errno==EINTR)l=0;
+		else return -1;
+	}
+	if(st->flags&NEOSC_STORE_SYNC)if(fdatasync(st->fd))return -1;
+	return 0;
+}
+
+static int update(STORE *st,unsigned char *key,int klen,long long value,
+	int journal)
+{
+	int r=0;
+	unsigned int h;
+	STRIPE *s;
+	ENTRY *e;
+	unsigned char rec[REC_SIZE];
+
+	h=hash(key,klen);
+	s=&st->stripe[h&st->mask];
+	h>>=st->shift;
+	pthread_mutex_lock(&s->mtx);
+	if((e=find(s,h,key,klen)))
+	{
+		if(value<=e->value)r=NEOSC_STORE_REPLAY;
+	}
+	else if(grow(s))r=-1;
+	if(!r&&journal)
+	{
+		encode(rec,key,klen,value);
+		if(append(st,rec,REC_SIZE))r=-1;
+		memclear(rec,0,REC_SIZE);
+	}
+	if(!r)
+	{
+		if(!e)e=insert(s,h,key,klen);
+		e->value=value;
+	}
+	pthread_mutex_unlock(&s->mtx);
+	return r;
+}
+
+static int recover(STORE *st)
+{
+	int l;
+	int r;
+	int klen;
+	off_t pos=0;
+	long long value;
+	unsigned char rec[REC_SIZE];
+
+	while(1)
+	{
+		for(r=0;r<REC_SIZE;r+=l)if((l=read(st->fd,rec+r,REC_SIZE-r))<=0)
+		{
+			if(l==-1&&errno==EINTR)l=0;
+			else if(l==-1)return -1;
+			else break;
+		}
+		if(r<REC_SIZE||decode(rec,&klen,&value))break;
+		if(update(st,rec+2,klen,value,0)==-1)return -1;
+		pos+=REC_SIZE;
+	}
+
+	memclear(rec,0,REC_SIZE);
+	if(ftruncate(st->fd,pos))return -1;
+	if(lseek(st->fd,pos,SEEK_SET)==-1)return -1;
+	return 0;
+}
+
+int neosc_store_open(char *file,int stripes,int flags,void **store)
+{
+	int i;
+	STORE *st;
+
+	if(!store||stripes<1||stripes>MAX_STRIPES||(stripes&(stripes-1))||
+		(flags&~NEOSC_STORE_SYNC))return -1;
+
+	if(!(st=malloc(sizeof(STORE))))return -1;
+	memset(st,0,sizeof(STORE));
+	st->fd=-1;
+	st->flags=flags;
+	st->mask=stripes-1;
+	for(st->shift=0;(1<<st->shift)<stripes;st->shift++);
+	if(pthread_rwlock_init(&st->jrnl,NULL))goto err1;
+	if(!(st->stripe=calloc(stripes,sizeof(STRIPE))))goto err2;
+	for(i=0;i<stripes;i++)
+	{
+		st->stripe[i].size=16;
+		if(!(st->stripe[i].tab=calloc(16,sizeof(ENTRY))))goto err3;
+		if(pthread_mutex_init(&st->stripe[i].mtx,NULL))
+		{
+			free(st->stripe[i].tab);
+			goto err3;
+		}
+	}
+
+	if(file)
+	{
+		if(!(st->file=strdup(file)))goto err3;
+		if((st->fd=open(file,O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC,0600))
+			==-1)goto err4;
+		if(recover(st))goto err5;
+	}
+
+	*store=st;
+	return 0;
+
+err5:	close(st->fd);
+err4:	free(st->file);
+err3:	while(i--)
+	{
+		pthread_mutex_destroy(&st->stripe[i].mtx);
+		free(st->stripe[i].tab);
+	}
+	free(st->stripe);
+err2:	pthread_rwlock_destroy(&st->jrnl);
+err1:	free(st);
+	return -1;
+}
+
+int neosc_store_get(void *store,unsigned char *key,int klen,long long *value)
+{
+	int r=-1;
+	unsigned int h;
+	STORE *st=store;
+	STRIPE *s;
+	ENTRY *e;
+
+	if(!st||!key||klen<0||klen>NEOSC_STORE_KEYLEN||!value)return -1;
+
+	h=hash(key,klen);
+	s=&st->stripe[h&st->mask];
+	pthread_mutex_lock(&s->mtx);
+	if((e=find(s,h>>st->shift,key,klen)))
+	{
+		*value=e->value;
+		r=0;
+	}
+	pthread_mutex_unlock(&s->mtx);
+	return r;
+}
+
+int neosc_store_advance(void *store,unsigned char *key,int klen,
+	long long value)
+{
+	int r;
+	STORE *st=store;
+
+	if(!st||!key||klen<0||klen>NEOSC_STORE_KEYLEN)return -1;
+
+	if(st->fd==-1)return update(st,key,klen,value,0);
+
+	pthread_rwlock_rdlock(&st->jrnl);
+	r=update(st,key,klen,value,1);
+	pthread_rwlock_unlock(&st->jrnl);
+	return r;
+}
+
+int neosc_store_snapshot(void *store)
+{
+	int l;
+	int r=-1;
+	int fd;
+	int len;
+	unsigned int i;
+	unsigned int j;
+	char *tmp;
+	STORE *st=store;
+	STRIPE *s;
+	unsigned char rec[REC_SIZE];
+
+	if(!st)return -1;
+	if(st->fd==-1)return 0;
+
+	len=strlen(st->file);
+	if(!(tmp=malloc(len+8)))return -1;
+	memcpy(tmp,st->file,len);
+	strcpy(tmp+len,".XXXXXX");
+
+	pthread_rwlock_wrlock(&st->jrnl);
+	if((fd=mkstemp(tmp))==-1)goto err1;
+
+	for(i=0;i<=st->mask;i++)
+	{
+		s=&st->stripe[i];
+		pthread_mutex_lock(&s->mtx);
+		for(j=0;j<s->size;j++)if(s->tab[j].used)
+		{
+			encode(rec,s->tab[j].key,s->tab[j].klen,
+				s->tab[j].value);
+			for(len=0;len<REC_SIZE;)
+				if((l=write(fd,rec+len,REC_SIZE-len))>0)len+=l;
+				else if(l==-1&&errno==EINTR)continue;
+				else break;
+			if(len!=REC_SIZE)break;
+		}
+		pthread_mutex_unlock(&s->mtx);
+		if(j!=s->size)goto err2;
+	}
+
+	if(fsync(fd))goto err2;
+	if(fcntl(fd,F_SETFL,O_APPEND)||fcntl(fd,F_SETFD,FD_CLOEXEC))goto err2;
+	if(rename(tmp,st->file))goto err2;
+	close(st->fd);
+	st->fd=fd;
+	r=0;
+	goto err1;
+
+err2:	close(fd);
+	unlink(tmp);
+err1:	pthread_rwlock_unlock(&st->jrnl);
+	memclear(rec,0,REC_SIZE);
+	free(tmp);
+	return r;
+}
+
+void neosc_store_close(void *store)
+{
+	unsigned int i;
+	STORE *st=store;
+
+	if(!st)return;
+	if(st->fd!=-1)close(st->fd);
+	for(i=0;i<=st->mask;i++)
+	{
+		pthread_mutex_destroy(&st->stripe[i].mtx);
+		memclear(st->stripe[i].tab,0,
+			st->stripe[i].size*sizeof(ENTRY));
+		free(st->stripe[i].tab);
+	}
+	free(st->stripe);
+	pthread_rwlock_destroy(&st->jrnl);
+	free(st->file);
+	free(st);
+}
@@ -22,6 +22,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 #include <libusb.h>
 #include "libneosc.h"
 
@@ -34,6 +36,16 @@ typedef struct
 	libusb_device_handle *handle;
 } CTX;
 
+typedef struct
+{
+	pthread_t tid;
+	int serial;
+	int total;
+	int failed;
+	NEOSC_USB_HMAC_JOB *job;
+	struct timespec start;
+} WORKER;
+
 static unsigned short crc16(unsigned char *ptr,int len)
 {
 	int i;
@@ -434,6 +446,103 @@ int neosc_usb_read_otp(void *handle,int slot,unsigned char *in,int ilen,
 	return 0;
 }
 
+static int expired(struct timespec *start,int timeout)
+{
+	long long msec;
+	struct timespec now;
+
+	if(!timeout)return 0;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	msec=(now.tv_sec-start->tv_sec)*1000LL;
+	msec+=(now.tv_nsec-start->tv_nsec)/1000000;
+	return msec>=timeout?1:0;
+}
+
+static void *hmac_worker(void *data)
+{
+	WORKER *w=data;
+	int i;
+	void *handle;
+
+	if(neosc_usb_open(&handle,w->serial,NULL))
+	{
+		for(i=0;i<w->total;i++)if(w->job[i].serial==w->serial&&
+			w->job[i].result==NEOSC_JOB_PENDING)
+		{
+			w->job[i].result=NEOSC_JOB_FAILED;
+			w->failed=1;
+		}
+		return NULL;
+	}
+
+	for(i=0;i<w->total;i++)if(w->job[i].serial==w->serial&&
+		w->job[i].result==NEOSC_JOB_PENDING)
+	{
+		if(expired(&w->start,w->job[i].timeout))
+			w->job[i].result=NEOSC_JOB_TIMEOUT;
+		else if(neosc_usb_read_hmac(handle,w->job[i].slot,
+			w->job[i].challenge,w->job[i].ilen,w->job[i].response,
+			NEOSC_SHA1_SIZE))w->job[i].result=NEOSC_JOB_FAILED;
+		else w->job[i].result=NEOSC_JOB_DONE;
+		if(w->job[i].result!=NEOSC_JOB_DONE)w->failed=1;
+	}
+
+	neosc_usb_close(handle);
+	return NULL;
+}
+
+int neosc_usb_hmac_batch(NEOSC_USB_HMAC_JOB *job,int total)
+{
+	int i;
+	int j;
+	int n=0;
+	int r=0;
+	WORKER *w;
+
+	if(!job||total<1)return -1;
+	if(!(w=malloc(total*sizeof(WORKER))))return -1;
+
+	for(i=0;i<total;i++)
+	{
+		job[i].result=NEOSC_JOB_PENDING;
+		memclear(job[i].response,0,NEOSC_SHA1_SIZE);
+		if(job[i].serial<=0||job[i].slot<0||job[i].slot>1||
+			job[i].ilen<1||job[i].ilen>64||job[i].timeout<0)
+		{
+			job[i].result=NEOSC_JOB_FAILED;
+			r=-1;
+			continue;
+		}
+		for(j=0;j<n;j++)if(w[j].serial==job[i].serial)break;
+		if(j<n)continue;
+		w[n].serial=job[i].serial;
+		w[n].total=total;
+		w[n].failed=0;
+		w[n].job=job;
+		n++;
+	}
+
+	for(i=0;i<n;i++)
+	{
+		clock_gettime(CLOCK_MONOTONIC,&w[i].start);
+		if(pthread_create(&w[i].tid,NULL,hmac_worker,&w[i]))
+		{
+			w[i].tid=pthread_self();
+			hmac_worker(&w[i]);
+		}
+	}
+
+	for(i=0;i<n;i++)
+	{
+		if(!pthread_equal(w[i].tid,pthread_self()))
+			pthread_join(w[i].tid,NULL);
+		if(w[i].failed)r=-1;
+	}
+
+	free(w);
+	return r;
+}
+
 int neosc_usb_write_ndef(void *handle,int slot,char *url,char *txt,char *lang,
 	unsigned char *code,int codelen)
 {
@@ -599,95 +708,119 @@ repeat:	len=7;
 	return 0;
 }
 
-int neosc_usb_config(void *handle,int command,int tktflags,int cfgflags,
-	int extflags,unsigned char *fixeddata,int fixedlen,
-	unsigned char *uidpart,int uidlen,unsigned char *aesdata,int aeslen,
-	unsigned char *newcode,int newlen,unsigned char *code,int codelen)
+int neosc_usb_slot(void *handle,NEOSC_SLOT_CONFIG *cfg)
 {
 	int len;
 	int seq;
+	int command;
 	int retry=1;
-	unsigned short crc;
-	unsigned char wrk[58];
+	unsigned char wrk[8];
+	unsigned char data[NEOSC_SLOT_SIZE];
 
 	if(!handle)return -1;
-	if(code&&codelen!=6)return -1;
-	if(newcode&&newlen!=6)return -1;
-	if(fixeddata)if(fixedlen<0||fixedlen>16)return -1;
-	if(uidpart&&uidlen!=4&&uidlen!=6)return -1;
-	if(aesdata&&aeslen!=16)return -1;
+	if(neosc_slot_encode(cfg,&command,data))return -1;
 
 repeat:	len=7;
-	if(rx(handle,wrk,&len,0))return -1;
+	if(rx(handle,wrk,&len,0))goto fail;
 	seq=wrk[4];
 
-	memset(wrk,0,58);
-	if(fixeddata)
-	{
-		memcpy(wrk,fixeddata,fixedlen);
-		wrk[44]=(unsigned char)fixedlen;
-	}
-	if(uidpart)memcpy(wrk+16,uidpart,uidlen);
-	if(aesdata)memcpy(wrk+22,aesdata,16);
-	if(newcode)memcpy(wrk+38,newcode,6);
-	wrk[45]=(unsigned char)extflags;
-	wrk[46]=(unsigned char)tktflags;
-	wrk[47]=(unsigned char)cfgflags;
-	crc=~crc16(wrk,50);
-	wrk[50]=(unsigned char)crc;
-	wrk[51]=(unsigned char)(crc>>8);
-	if(code)memcpy(wrk+52,code,6);
-
-	if(tx(handle,command,wrk,58))
-	{
-		memclear(wrk,0,58);
-		return -1;
-	}
-	memclear(wrk,0,58);
+	if(tx(handle,command,data,NEOSC_SLOT_SIZE))goto fail;
 
 	len=-7;
-	if(rx(handle,wrk,&len,0))return -1;
+	if(rx(handle,wrk,&len,0))goto fail;
 
 	if(seq==wrk[4])
 	{
-		if(!retry--)return -1;
+		if(!retry--)goto fail;
 		usleep(250000);
 		goto repeat;
 	}
 
+	memclear(data,0,NEOSC_SLOT_SIZE);
 	return 0;
+
+fail:	memclear(data,0,NEOSC_SLOT_SIZE);
+	return -1;
+}
+
+int neosc_usb_config(void *handle,int command,int tktflags,int cfgflags,
+	int extflags,unsigned char *fixeddata,int fixedlen,
+	unsigned char *uidpart,int uidlen,unsigned char *aesdata,int aeslen,
+	unsigned char *newcode,int newlen,unsigned char *code,int codelen)
+{
+	NEOSC_SLOT_CONFIG cfg;
+
+	memset(&cfg,0,sizeof(cfg));
+	cfg.type=NEOSC_SLOT_RAW;
+	cfg.command=command;
+	cfg.tktflags=tktflags;
+	cfg.cfgflags=cfgflags;
+	cfg.extflags=extflags;
+	cfg.pubid=fixeddata;
+	cfg.publen=fixedlen;
+	cfg.privid=uidpart;
+	cfg.privlen=uidlen;
+	cfg.aesdata=aesdata;
+	cfg.aeslen=aeslen;
+	cfg.newcode=newcode;
+	cfg.newlen=newlen;
+	cfg.code=code;
+	cfg.codelen=codelen;
+	return neosc_usb_slot(handle,&cfg);
 }
 
 int neosc_usb_swap(void *handle,unsigned char *newcode,int newlen,
 	unsigned char *code,int codelen)
 {
-	return neosc_usb_config(handle,0x06,0,0,0,NULL,0,NULL,0,NULL,0,
-		newcode,newlen,code,codelen);
+	NEOSC_SLOT_CONFIG cfg;
+
+	memset(&cfg,0,sizeof(cfg));
+	cfg.type=NEOSC_SLOT_SWAP;
+	cfg.newcode=newcode;
+	cfg.newlen=newlen;
+	cfg.code=code;
+	cfg.codelen=codelen;
+	return neosc_usb_slot(handle,&cfg);
 }
 
 int neosc_usb_update(void *handle,int slot,int tktflags,int cfgflags,
 	int extflags,unsigned char *newcode,int newlen,unsigned char *code,
 	int codelen)
 {
-	if(slot^(slot&1))return -1;
-	if((tktflags&~0x3f)||(cfgflags&~0x0c)||(extflags&~0xff))return -1;
-	if((extflags&0x60)==0x40)return -1;
-
-	return neosc_usb_config(handle,slot?0x05:0x04,tktflags,cfgflags,
-		extflags,NULL,0,NULL,0,NULL,0,newcode,newlen,code,codelen);
+	NEOSC_SLOT_CONFIG cfg;
+
+	memset(&cfg,0,sizeof(cfg));
+	cfg.type=NEOSC_SLOT_UPDATE;
+	cfg.slot=slot;
+	cfg.tktflags=tktflags;
+	cfg.cfgflags=cfgflags;
+	cfg.extflags=extflags;
+	cfg.newcode=newcode;
+	cfg.newlen=newlen;
+	cfg.code=code;
+	cfg.codelen=codelen;
+	return neosc_usb_slot(handle,&cfg);
 }
 
 int neosc_usb_hmac(void *handle,int slot,unsigned char *aesdata,int aeslen,
 	int tktflags,int cfgflags,int extflags,unsigned char *newcode,
 	int newlen,unsigned char *code,int codelen)
 {
-	if((slot^(slot&1))||!aesdata||aeslen!=20||(tktflags&~0x80)||
-		(cfgflags&~0x0c)||(extflags&~0xff))return -1;
-	if((extflags&0x60)==0x40)return -1;
-
-	return neosc_usb_config(handle,slot?0x03:0x01,tktflags|0x40,
-		cfgflags|0x22,extflags,NULL,0,aesdata+16,4,aesdata,16,
-		newcode,newlen,code,codelen);
+	NEOSC_SLOT_CONFIG cfg;
+
+	memset(&cfg,0,sizeof(cfg));
+	cfg.type=NEOSC_SLOT_HMAC;
+	cfg.slot=slot;
+	cfg.aesdata=aesdata;
+	cfg.aeslen=aeslen;
+	cfg.tktflags=tktflags;
+	cfg.cfgflags=cfgflags;
+	cfg.extflags=extflags;
+	cfg.newcode=newcode;
+	cfg.newlen=newlen;
+	cfg.code=code;
+	cfg.codelen=codelen;
+	return neosc_usb_slot(handle,&cfg);
 }
 
 int neosc_usb_otp(void *handle,int slot,unsigned char *privid,int privlen,
@@ -695,14 +828,23 @@ int neosc_usb_otp(void *handle,int slot,unsigned char *privid,int privlen,
 	int extflags,unsigned char *newcode,int newlen,unsigned char *code,
 	int codelen)
 {
-	if((slot^(slot&1))||!aesdata||aeslen!=16||(tktflags&~0x80)||
-		(cfgflags&~0x08)||(extflags&~0xff))return -1;
-	if((extflags&0x60)==0x40)return -1;
-	if(privid&&privlen!=6)return -1;
-
-	return neosc_usb_config(handle,slot?0x03:0x01,tktflags|0x40,
-		cfgflags|0x20,extflags,NULL,0,privid,6,aesdata,16,
-		newcode,newlen,code,codelen);
+	NEOSC_SLOT_CONFIG cfg;
+
+	memset(&cfg,0,sizeof(cfg));
+	cfg.type=NEOSC_SLOT_OTP;
+	cfg.slot=slot;
+	cfg.privid=privid;
+	cfg.privlen=privlen;
+	cfg.aesdata=aesdata;
+	cfg.aeslen=aeslen;
+	cfg.tktflags=tktflags;
+	cfg.cfgflags=cfgflags;
+	cfg.extflags=extflags;
+	cfg.newcode=newcode;
+	cfg.newlen=newlen;
+	cfg.code=code;
+	cfg.codelen=codelen;
+	return neosc_usb_slot(handle,&cfg);
 }
 
 int neosc_usb_hotp(void *handle,int slot,int omp,int tt,int mui,int imf,
@@ -710,46 +852,25 @@ int neosc_usb_hotp(void *handle,int slot,int omp,int tt,int mui,int imf,
 	int extflags,unsigned char *newcode,int newlen,unsigned char *code,
 	int codelen)
 {
-	int r;
-	int fixedlen=0;
-	unsigned char uidpart[6];
-	unsigned char fixeddata[6];
-
-	if((slot^(slot&1))||!aesdata||aeslen!=20||(tktflags&~0xbf)||
-		(cfgflags&~0x5f)||(extflags&~0xff))return -1;
-	if((extflags&0x60)==0x40)return -1;
-	if(omp<0||omp>255||tt<0||tt>255||mui<-1||mui>99999999)return -1;
-	if(imf<0||imf>0xffff0||(imf&0xf))return -1;
-
-	if(mui>=0)
-	{
-		fixedlen=6;
-		fixeddata[0]=(unsigned char)omp;
-		fixeddata[1]=(unsigned char)tt;
-		fixeddata[2]=(unsigned char)
-				(((mui/10000000)<<4)|((mui/1000000)%10));
-		fixeddata[3]=(unsigned char)
-				((((mui/100000)%10)<<4)|((mui/10000)%10));
-		fixeddata[4]=(unsigned char)
-				((((mui/1000)%10)<<4)|((mui/100)%10));
-		fixeddata[5]=(unsigned char)((((mui/10)%10)<<4)|(mui%10));
-	}
-	else if(cfgflags&0x50)return -1;
-
-	uidpart[0]=aesdata[16];
-	uidpart[1]=aesdata[17];
-	uidpart[2]=aesdata[18];
-	uidpart[3]=aesdata[19];
-	uidpart[4]=(unsigned char)(imf>>12);
-	uidpart[5]=(unsigned char)(imf>>4);
-
-	r=neosc_usb_config(handle,slot?0x03:0x01,tktflags|0x40,
-		cfgflags,extflags,fixedlen?fixeddata:NULL,fixedlen,uidpart,6,
-		aesdata,16,newcode,newlen,code,codelen);
-
-	memclear(uidpart,0,6);
-	memclear(fixeddata,0,6);
-	return r;
+	NEOSC_SLOT_CONFIG cfg;
+
+	memset(&cfg,0,sizeof(cfg));
+	cfg.type=NEOSC_SLOT_HOTP;
+	cfg.slot=slot;
+	cfg.omp=omp;
+	cfg.tt=tt;
+	cfg.mui=mui;
+	cfg.imf=imf;
+	cfg.aesdata=aesdata;
+	cfg.aeslen=aeslen;
+	cfg.tktflags=tktflags;
+	cfg.cfgflags=cfgflags;
+	cfg.extflags=extflags;
+	cfg.newcode=newcode;
+	cfg.newlen=newlen;
+	cfg.code=code;
+	cfg.codelen=codelen;
+	return neosc_usb_slot(handle,&cfg);
 }
 
 int neosc_usb_yubiotp(void *handle,int slot,unsigned char *pubid,int publen,
@@ -757,14 +878,25 @@ int neosc_usb_yubiotp(void *handle,int slot,unsigned char *pubid,int publen,
 	int tktflags,int cfgflags,int extflags,unsigned char *newcode,
 	int newlen,unsigned char *code,int codelen)
 {
-	if((slot^(slot&1))||!aesdata||aeslen!=16||(tktflags&~0xbf)||
-		(cfgflags&~0x0d)||(extflags&~0xff))return -1;
-	if((extflags&0x60)==0x40)return -1;
-	if(privid&&privlen!=6)return -1;
-
-	return neosc_usb_config(handle,slot?0x03:0x01,tktflags,cfgflags,
-		extflags,pubid,publen,privid,privlen,aesdata,16,newcode,newlen,
-		code,codelen);
+	NEOSC_SLOT_CONFIG cfg;
+
+	memset(&cfg,0,sizeof(cfg));
+	cfg.type=NEOSC_SLOT_YUBIOTP;
+	cfg.slot=slot;
+	cfg.pubid=pubid;
+	cfg.publen=publen;
+	cfg.privid=privid;
+	cfg.privlen=privlen;
+	cfg.aesdata=aesdata;
+	cfg.aeslen=aeslen;
+	cfg.tktflags=tktflags;
+	cfg.cfgflags=cfgflags;
+	cfg.extflags=extflags;
+	cfg.newcode=newcode;
+	cfg.newlen=newlen;
+	cfg.code=code;
+	cfg.codelen=codelen;
+	return neosc_usb_slot(handle,&cfg);
 }
 
 int neosc_usb_passwd(void *handle,int slot,unsigned char *pubid,int publen,
@@ -772,15 +904,23 @@ int neosc_usb_passwd(void *handle,int slot,unsigned char *pubid,int publen,
 	int tktflags,int cfgflags,int extflags,unsigned char *newcode,
 	int newlen,unsigned char *code,int codelen)
 {
-	if((slot^(slot&1))||!aesdata||aeslen!=16||(tktflags&~0xbf)||
-		(cfgflags&~0xdf)||(extflags&~0xff))return -1;
-	if((extflags&0x60)==0x40)return -1;
-	if(!privid||privlen!=6)return -1;
-	if(pubid&&publen<=0)return -1;
-	if((cfgflags&0x02)&&pubid)return -1;
-	if((cfgflags&0x41)==0x01)return -1;
-
-	return neosc_usb_config(handle,slot?0x03:0x01,tktflags,cfgflags|0x20,
-		extflags,pubid,publen,privid,privlen,aesdata,16,newcode,newlen,
-		code,codelen);
+	NEOSC_SLOT_CONFIG cfg;
+
+	memset(&cfg,0,sizeof(cfg));
+	cfg.type=NEOSC_SLOT_PASSWD;
+	cfg.slot=slot;
+	cfg.pubid=pubid;
+	cfg.publen=publen;
+	cfg.privid=privid;
+	cfg.privlen=privlen;
+	cfg.aesdata=aesdata;
+	cfg.aeslen=aeslen;
+	cfg.tktflags=tktflags;
+	cfg.cfgflags=cfgflags;
+	cfg.extflags=extflags;
+	cfg.newcode=newcode;
+	cfg.newlen=newlen;
+	cfg.code=code;
+	cfg.codelen=codelen;
+	return neosc_usb_slot(handle,&cfg);
 }
@@ -24,11 +24,38 @@
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define X86
+#endif
 #include "libneosc.h"
 
 #define memclear(a,b,c) \
     do { memset(a,b,c); *(volatile char*)(a)=*(volatile char*)(a); } while(0)
 
+#define IDX_MAGIC	"NEOSCIDX"
+#define IDX_VERSION	1
+#define IDX_HEADER	32
+#define IDX_RECORD	64
+#define IDX_KICKS	256
+#define IDX_SEEDS	16
+#define IDX_MAXSIZE	0x1000000
+
+typedef struct
+{
+	char *file;
+	unsigned char *map;
+	size_t len;
+	unsigned int size;
+	unsigned int seed1;
+	unsigned int seed2;
+	dev_t dev;
+	ino_t ino;
+} INDEX;
+
 static char *uritab[0x24]=
 {
 	"",
@@ -149,128 +176,814 @@ int neosc_util_random(unsigned char *out,int olen)
 	return 0;
 }
 
-int neosc_util_modhex_encode(unsigned char *in,int ilen,char *out,int *olen)
+typedef struct
 {
-	static char *modhex="cbdefghijklnrtuv";
+	char enc[16];
+	unsigned char dec[256];
+	unsigned char t1[16];
+	unsigned char t2[16];
+	unsigned char m1;
+	unsigned char v1;
+	unsigned char m2;
+	unsigned char v2;
+} NIBCODEC;
 
-	if(!in||ilen<0||!out||!olen||*olen<(ilen<<1)+1)return -1;
+static const NIBCODEC hexcodec=
+{
+	"0123456789abcdef",
+	{
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,
+		0x08,0x09,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff
+	},
+	{
+		0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,
+		0x08,0x09,0xff,0xff,0xff,0xff,0xff,0xff
+	},
+	{
+		0xff,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff
+	},
+	0xf0,0x30,0xd0,0x40
+};
+
+static const NIBCODEC modhexcodec=
+{
+	"cbdefghijklnrtuv",
+	{
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0x01,0x00,0x02,0x03,0x04,0x05,
+		0x06,0x07,0x08,0x09,0x0a,0xff,0x0b,0xff,
+		0xff,0xff,0x0c,0xff,0x0d,0x0e,0x0f,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0x01,0x00,0x02,0x03,0x04,0x05,
+		0x06,0x07,0x08,0x09,0x0a,0xff,0x0b,0xff,
+		0xff,0xff,0x0c,0xff,0x0d,0x0e,0x0f,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff
+	},
+	{
+		0xff,0xff,0x01,0x00,0x02,0x03,0x04,0x05,
+		0x06,0x07,0x08,0x09,0x0a,0xff,0x0b,0xff
+	},
+	{
+		0xff,0xff,0x0c,0xff,0x0d,0x0e,0x0f,0xff,
+		0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff
+	},
+	0xd0,0x40,0xd0,0x50
+};
+
+static int nibenc_std(const NIBCODEC *c,unsigned char *in,int ilen,char *out)
+{
+	register int i;
+
+	for(i=0;i<ilen;i++,in++,out+=2)
+	{
+		out[0]=c->enc[*in>>4];
+		out[1]=c->enc[*in&0xf];
+	}
+	return i;
+}
+
+static int nibdec_std(const NIBCODEC *c,char *in,int ilen,unsigned char *out)
+{
+	register int i;
+	register unsigned int h;
+	register unsigned int l;
+
+	for(i=0;ilen-i>1;i+=2,in+=2,out++)
+	{
+		h=c->dec[(unsigned char)in[0]];
+		l=c->dec[(unsigned char)in[1]];
+		if((h|l)&0x80)break;
+		*out=(unsigned char)((h<<4)|l);
+	}
+	return i;
+}
+
+static int nibscan_std(const NIBCODEC *c,char *in,int ilen)
+{
+	register int i;
+
+	for(i=0;i<ilen;i++)if(c->dec[(unsigned char)in[i]]&0x80)break;
+	return i;
+}
+
+#ifdef X86
 
-	for(*olen=0;ilen--;in++)
+__attribute__((target("avx2"))) static inline __attribute__((always_inline))
+	__m256i nibble32(const NIBCODEC *c,__m256i v)
+{
+	__m256i lo;
+	__m256i s1;
+	__m256i s2;
+
+	lo=_mm256_and_si256(v,_mm256_set1_epi8(0x0f));
+	s1=_mm256_cmpeq_epi8(_mm256_and_si256(v,_mm256_set1_epi8(c->m1)),
+		_mm256_set1_epi8(c->v1));
+	s2=_mm256_cmpeq_epi8(_mm256_and_si256(v,_mm256_set1_epi8(c->m2)),
+		_mm256_set1_epi8(c->v2));
+	return _mm256_or_si256(_mm256_or_si256(
+		_mm256_and_si256(s1,_mm256_shuffle_epi8(
+		_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)c->t1)),
+		lo)),_mm256_and_si256(s2,_mm256_shuffle_epi8(
+		_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)c->t2)),
+		lo))),_mm256_andnot_si256(_mm256_or_si256(s1,s2),
+		_mm256_set1_epi8(-1)));
+}
+
+__attribute__((target("avx2"))) static int nibenc_avx2(const NIBCODEC *c,
+	unsigned char *in,int ilen,char *out)
+{
+	register int i;
+	__m256i v;
+	__m256i h;
+	__m256i l;
+	const __m256i tab=_mm256_broadcastsi128_si256(
+		_mm_loadu_si128((__m128i *)c->enc));
+
+	for(i=0;ilen-i>=32;i+=32,in+=32,out+=64)
 	{
-		out[(*olen)++]=modhex[*in>>4];
-		out[(*olen)++]=modhex[*in&0xf];
+		v=_mm256_loadu_si256((__m256i *)in);
+		h=_mm256_shuffle_epi8(tab,_mm256_and_si256(
+			_mm256_srli_epi16(v,4),_mm256_set1_epi8(0x0f)));
+		l=_mm256_shuffle_epi8(tab,_mm256_and_si256(v,
+			_mm256_set1_epi8(0x0f)));
+		v=_mm256_unpacklo_epi8(h,l);
+		h=_mm256_unpackhi_epi8(h,l);
+		_mm256_storeu_si256((__m256i *)out,
+			_mm256_permute2x128_si256(v,h,0x20));
+		_mm256_storeu_si256((__m256i *)(out+32),
+			_mm256_permute2x128_si256(v,h,0x31));
 	}
+	return i+nibenc_std(c,in,ilen-i,out);
+}
+
+__attribute__((target("avx2"))) static int nibdec_avx2(const NIBCODEC *c,
+	char *in,int ilen,unsigned char *out)
+{
+	register int i;
+	__m256i v;
+
+	for(i=0;ilen-i>=32;i+=32,in+=32,out+=16)
+	{
+		v=nibble32(c,_mm256_loadu_si256((__m256i *)in));
+		if(_mm256_movemask_epi8(v))break;
+		v=_mm256_maddubs_epi16(v,_mm256_set1_epi16(0x0110));
+		v=_mm256_permute4x64_epi64(_mm256_packus_epi16(v,v),0x08);
+		_mm_storeu_si128((__m128i *)out,_mm256_castsi256_si128(v));
+	}
+	return i+nibdec_std(c,in,ilen-i,out);
+}
+
+__attribute__((target("avx2"))) static int nibscan_avx2(const NIBCODEC *c,
+	char *in,int ilen)
+{
+	register int i;
+	register unsigned int m;
+
+	for(i=0;ilen-i>=32;i+=32,in+=32)
+		if((m=_mm256_movemask_epi8(nibble32(c,
+			_mm256_loadu_si256((__m256i *)in)))))
+			return i+__builtin_ctz(m);
+	return i+nibscan_std(c,in,ilen-i);
+}
+
+#endif
+
+static int (*nibenc)(const NIBCODEC *c,unsigned char *in,int ilen,
+	char *out)=nibenc_std;
+static int (*nibdec)(const NIBCODEC *c,char *in,int ilen,
+	unsigned char *out)=nibdec_std;
+static int (*nibscan)(const NIBCODEC *c,char *in,int ilen)=nibscan_std;
+
+static int nibencode(const NIBCODEC *c,unsigned char *in,int ilen,char *out,
+	int *olen)
+{
+	if(!in||ilen<0||!out||!olen||*olen<(ilen<<1)+1)return -1;
+
+	*olen=nibenc(c,in,ilen,out)<<1;
 	out[*olen]=0;
 	return 0;
 }
 
-int neosc_util_modhex_decode(char *in,int ilen,unsigned char *out,int *olen)
+static int nibdecode(const NIBCODEC *c,char *in,int ilen,unsigned char *out,
+	int *olen)
 {
-	unsigned char n;
-	int f;
+	register unsigned int n;
 
 	if(!in||ilen<0||!out||!olen||*olen<((ilen+1)>>1))return -1;
 
-	if((f=ilen&1))*out=0x00;
-	for(*olen=0;ilen--;f^=1,in++)
+	*olen=0;
+	if(ilen&1)
+	{
+		if((n=c->dec[(unsigned char)*in++])&0x80)return -1;
+		*out++=(unsigned char)n;
+		*olen=1;
+		ilen--;
+	}
+	if(nibdec(c,in,ilen,out)!=ilen)return -1;
+	*olen+=ilen>>1;
+	return 0;
+}
+
+static int nibverify(const NIBCODEC *c,char *in,int ilen,int *offset)
+{
+	if(!offset)return -1;
+	*offset=-1;
+	if(!in||ilen<0)return -1;
+
+	if((*offset=nibscan(c,in,ilen))==ilen)
+	{
+		*offset=-1;
+		return 0;
+	}
+	return -1;
+}
+
+int neosc_util_modhex_encode(unsigned char *in,int ilen,char *out,int *olen)
+{
+	return nibencode(&modhexcodec,in,ilen,out,olen);
+}
+
+int neosc_util_modhex_decode(char *in,int ilen,unsigned char *out,int *olen)
+{
+	return nibdecode(&modhexcodec,in,ilen,out,olen);
+}
+
+int neosc_util_modhex_verify(char *in,int ilen,int *offset)
+{
+	return nibverify(&modhexcodec,in,ilen,offset);
+}
+
+static unsigned int idx_hash(unsigned int seed,unsigned char *pubid,int publen)
+{
+	unsigned int h=0x811c9dc5^seed;
+
+	while(publen--)h=(h^*pubid++)*0x01000193;
+	h^=h>>16;
+	h*=0x7feb352d;
+	h^=h>>15;
+	return h;
+}
+
+static void idx_put(unsigned char *ptr,unsigned int val)
+{
+	ptr[0]=(unsigned char)val;
+	ptr[1]=(unsigned char)(val>>8);
+	ptr[2]=(unsigned char)(val>>16);
+	ptr[3]=(unsigned char)(val>>24);
+}
+
+static unsigned int idx_get(unsigned char *ptr)
+{
+	return ptr[0]|(ptr[1]<<8)|(ptr[2]<<16)|((unsigned int)ptr[3]<<24);
+}
+
+static int idx_match(NEOSC_YUBIOTP_CRED *c1,NEOSC_YUBIOTP_CRED *c2)
+{
+	return c1->publen==c2->publen&&!memcmp(c1->pubid,c2->pubid,c1->publen);
+}
+
+static int idx_place(NEOSC_YUBIOTP_CRED *cred,int total,int *slot,
+	unsigned int size,unsigned int seed1,unsigned int seed2)
+{
+	int i;
+	int j;
+	int k;
+	int l;
+	unsigned int h;
+	unsigned int h1;
+	unsigned int h2;
+
+	for(h=0;h<size;h++)slot[h]=-1;
+
+	for(i=0;i<total;i++)
 	{
-		switch((*in>='A'&&*in<='Z'?*in|0x20:*in))
+		h1=idx_hash(seed1,cred[i].pubid,cred[i].publen)&(size-1);
+		h2=idx_hash(seed2,cred[i].pubid,cred[i].publen)&(size-1);
+		if((slot[h1]!=-1&&idx_match(&cred[slot[h1]],&cred[i]))||
+			(slot[h2]!=-1&&idx_match(&cred[slot[h2]],&cred[i])))
+			return -1;
+
+		for(j=i,h=h1,k=0;slot[h]!=-1;k++)
 		{
-		case 'c':n=0x00;break;
-		case 'b':n=0x01;break;
-		case 'd':n=0x02;break;
-		case 'e':n=0x03;break;
-		case 'f':n=0x04;break;
-		case 'g':n=0x05;break;
-		case 'h':n=0x06;break;
-		case 'i':n=0x07;break;
-		case 'j':n=0x08;break;
-		case 'k':n=0x09;break;
-		case 'l':n=0x0a;break;
-		case 'n':n=0x0b;break;
-		case 'r':n=0x0c;break;
-		case 't':n=0x0d;break;
-		case 'u':n=0x0e;break;
-		case 'v':n=0x0f;break;
-		default:return -1;
+			if(k==IDX_KICKS)return 1;
+			l=slot[h];
+			slot[h]=j;
+			j=l;
+			h1=idx_hash(seed1,cred[j].pubid,cred[j].publen)&(size-1);
+			h=h!=h1?h1:idx_hash(seed2,cred[j].pubid,cred[j].publen)&
+				(size-1);
 		}
-		if(!f)out[*olen]=n<<4;
-		else out[(*olen)++]|=n;
+		slot[h]=j;
 	}
 	return 0;
 }
 
-int neosc_util_hex_encode(unsigned char *in,int ilen,char *out,int *olen)
+static int idx_syncdir(char *path)
 {
-	static char *hex="0123456789abcdef";
+	int fd;
+	int r=0;
+	char *ptr;
 
-	if(!in||ilen<0||!out||!olen||*olen<(ilen<<1)+1)return -1;
+	if(!(ptr=strrchr(path,'/')))strcpy(path,".");
+	else if(ptr==path)path[1]=0;
+	else *ptr=0;
+
+	if((fd=open(path,O_RDONLY|O_DIRECTORY|O_CLOEXEC))==-1)return -1;
+	if(fsync(fd))r=-1;
+	close(fd);
+	return r;
+}
+
+static int idx_map(INDEX *idx)
+{
+	int fd;
+	struct stat stb;
+	unsigned char *map;
 
-	for(*olen=0;ilen--;in++)
+	if((fd=open(idx->file,O_RDONLY|O_CLOEXEC))==-1)return -1;
+	if(fstat(fd,&stb)||stb.st_size<IDX_HEADER)goto err1;
+	if((map=mmap(NULL,stb.st_size,PROT_READ,MAP_SHARED,fd,0))==MAP_FAILED)
+		goto err1;
+	close(fd);
+
+	if(memcmp(map,IDX_MAGIC,8)||idx_get(map+8)!=IDX_VERSION)goto err2;
+	idx->size=idx_get(map+12);
+	if(!idx->size||(idx->size&(idx->size-1))||idx->size>IDX_MAXSIZE||
+		stb.st_size!=IDX_HEADER+(off_t)idx->size*IDX_RECORD)goto err2;
+	idx->seed1=idx_get(map+20);
+	idx->seed2=idx_get(map+24);
+
+	if(idx->map)munmap(idx->map,idx->len);
+	idx->map=map;
+	idx->len=stb.st_size;
+	idx->dev=stb.st_dev;
+	idx->ino=stb.st_ino;
+	return 0;
+
+err2:	munmap(map,stb.st_size);
+	return -1;
+err1:	close(fd);
+	return -1;
+}
+
+int neosc_util_index_build(char *file,NEOSC_YUBIOTP_CRED *cred,int total)
+{
+	int i;
+	int r;
+	int fd;
+	int *slot;
+	int len;
+	unsigned int n;
+	unsigned int size;
+	unsigned int seed1;
+	unsigned int seed2;
+	unsigned char *bfr;
+	unsigned char *ptr;
+	char *tmp;
+
+	if(!file||!cred||total<0||total>0x400000)return -1;
+	for(i=0;i<total;i++)if(cred[i].publen<0||cred[i].publen>16||
+		cred[i].usectr<-1||cred[i].usectr>0xffff||cred[i].sessctr<-1||
+		cred[i].sessctr>0xff)return -1;
+
+	for(size=16;size<(unsigned int)total<<1;size<<=1);
+
+	if(!(slot=malloc(size*sizeof(int))))return -1;
+	for(i=0;;i++)
+	{
+		if(i==IDX_SEEDS)
+		{
+			if(size==IDX_MAXSIZE)goto err1;
+			i=0;
+			size<<=1;
+			free(slot);
+			if(!(slot=malloc(size*sizeof(int))))return -1;
+		}
+		if(neosc_util_random((unsigned char *)&seed1,sizeof(seed1))||
+			neosc_util_random((unsigned char *)&seed2,sizeof(seed2)))
+			goto err1;
+		if(!(r=idx_place(cred,total,slot,size,seed1,seed2)))break;
+		if(r==-1)goto err1;
+	}
+
+	len=strlen(file);
+	if(!(tmp=malloc(len+8)))goto err1;
+	memcpy(tmp,file,len);
+	strcpy(tmp+len,".XXXXXX");
+	if(!(bfr=calloc(IDX_HEADER+size*IDX_RECORD,1)))goto err2;
+
+	memcpy(bfr,IDX_MAGIC,8);
+	idx_put(bfr+8,IDX_VERSION);
+	idx_put(bfr+12,size);
+	idx_put(bfr+16,total);
+	idx_put(bfr+20,seed1);
+	idx_put(bfr+24,seed2);
+	for(n=0,ptr=bfr+IDX_HEADER;n<size;n++,ptr+=IDX_RECORD)
+		if((i=slot[n])!=-1)
 	{
-		out[(*olen)++]=hex[*in>>4];
-		out[(*olen)++]=hex[*in&0xf];
+		ptr[0]=1;
+		ptr[1]=(unsigned char)cred[i].publen;
+		idx_put(ptr+4,cred[i].usectr);
+		idx_put(ptr+8,cred[i].sessctr);
+		memcpy(ptr+12,cred[i].pubid,cred[i].publen);
+		memcpy(ptr+28,cred[i].privid,6);
+		memcpy(ptr+34,cred[i].aeskey,16);
 	}
-	out[*olen]=0;
+	len=IDX_HEADER+size*IDX_RECORD;
+
+	if((fd=mkstemp(tmp))==-1)goto err3;
+	for(ptr=bfr;len;len-=r,ptr+=r)if((r=write(fd,ptr,len))<=0)
+	{
+		if(r==-1&&errno==EINTR)r=0;
+		else goto err4;
+	}
+	if(fsync(fd))goto err4;
+	if(close(fd))goto err5;
+	if(rename(tmp,file))goto err5;
+	r=idx_syncdir(tmp);
+
+	memclear(bfr,0,IDX_HEADER+size*IDX_RECORD);
+	free(bfr);
+	free(tmp);
+	free(slot);
+	return r;
+
+err4:	close(fd);
+err5:	unlink(tmp);
+err3:	memclear(bfr,0,IDX_HEADER+size*IDX_RECORD);
+	free(bfr);
+err2:	free(tmp);
+err1:	free(slot);
+	return -1;
+}
+
+int neosc_util_index_open(char *file,void **index)
+{
+	INDEX *idx;
+
+	if(!file||!index)return -1;
+
+	if(!(idx=malloc(sizeof(INDEX))))return -1;
+	memset(idx,0,sizeof(INDEX));
+	if(!(idx->file=strdup(file)))goto err1;
+	if(idx_map(idx))goto err2;
+	*index=idx;
 	return 0;
+
+err2:	free(idx->file);
+err1:	free(idx);
+	return -1;
 }
 
-int neosc_util_hex_decode(char *in,int ilen,unsigned char *out,int *olen)
+int neosc_util_index_reload(void *index)
 {
-	unsigned char n;
-	int f;
+	INDEX *idx=index;
+	struct stat stb;
 
-	if(!in||ilen<0||!out||!olen||*olen<((ilen+1)>>1))return -1;
+	if(!idx)return -1;
+	if(stat(idx->file,&stb))return -1;
+	if(stb.st_dev==idx->dev&&stb.st_ino==idx->ino)return 0;
+	return idx_map(idx);
+}
+
+int neosc_util_index_lookup(void *index,unsigned char *pubid,int publen,
+	NEOSC_YUBIOTP_CRED *cred)
+{
+	int i;
+	INDEX *idx=index;
+	unsigned char *ptr;
 
-	if((f=ilen&1))*out=0x00;
-	for(*olen=0;ilen--;f^=1,in++)
+	if(!idx||!pubid||publen<0||publen>16||!cred)return -1;
+
+	for(i=0;i<2;i++)
 	{
-		if(*in>='0'&&*in<='9')n=*in-'0';
-		else if(*in>='A'&&*in<='F')n=*in-'A'+10;
-		else if(*in>='a'&&*in<='f')n=*in-'a'+10;
-		else return -1;
-		if(!f)out[*olen]=n<<4;
-		else out[(*olen)++]|=n;
+		ptr=idx->map+IDX_HEADER+(size_t)(idx_hash(i?idx->seed2:idx->seed1,
+			pubid,publen)&(idx->size-1))*IDX_RECORD;
+		if(!ptr[0]||ptr[1]!=publen||memcmp(ptr+12,pubid,publen))
+			continue;
+		cred->publen=publen;
+		cred->usectr=(int)idx_get(ptr+4);
+		cred->sessctr=(int)idx_get(ptr+8);
+		memcpy(cred->pubid,pubid,publen);
+		memcpy(cred->privid,ptr+28,6);
+		memcpy(cred->aeskey,ptr+34,16);
+		return 0;
 	}
-	return 0;
+	return -1;
 }
 
-int neosc_util_base64_encode(unsigned char *in,int ilen,char *out,int *olen)
+void neosc_util_index_close(void *index)
+{
+	INDEX *idx=index;
+
+	if(!idx)return;
+	munmap(idx->map,idx->len);
+	free(idx->file);
+	free(idx);
+}
+
+int neosc_util_hex_encode(unsigned char *in,int ilen,char *out,int *olen)
+{
+	return nibencode(&hexcodec,in,ilen,out,olen);
+}
+
+int neosc_util_hex_decode(char *in,int ilen,unsigned char *out,int *olen)
+{
+	return nibdecode(&hexcodec,in,ilen,out,olen);
+}
+
+int neosc_util_hex_verify(char *in,int ilen,int *offset)
 {
-	static char *b64="ABCDEFGHIJKLMNOPQRSTUVWXYZabcdef"
+	return nibverify(&hexcodec,in,ilen,offset);
+}
+
+static const char b64[64]="ABCDEFGHIJKLMNOPQRSTUVWXYZabcdef"
 			 "ghijklmnopqrstuvwxyz0123456789+/";
 
-	if(!in||ilen<0||!out||!olen||*olen<(((ilen+2)/3)<<2)+1)return -1;
+static const unsigned char unb64[256]=
+{
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0x3e,0xff,0xff,0xff,0x3f,
+	0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x3b,
+	0x3c,0x3d,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0x00,0x01,0x02,0x03,0x04,0x05,0x06,
+	0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,
+	0x0f,0x10,0x11,0x12,0x13,0x14,0x15,0x16,
+	0x17,0x18,0x19,0xff,0xff,0xff,0xff,0xff,
+	0xff,0x1a,0x1b,0x1c,0x1d,0x1e,0x1f,0x20,
+	0x21,0x22,0x23,0x24,0x25,0x26,0x27,0x28,
+	0x29,0x2a,0x2b,0x2c,0x2d,0x2e,0x2f,0x30,
+	0x31,0x32,0x33,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+	0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff
+};
+
+static int enc64_std(unsigned char *in,int ilen,char *out)
+{
+	register int i;
 
-	for(*olen=0;ilen>2;ilen-=3,in+=3)
+	for(i=0;ilen-i>2;i+=3,in+=3,out+=4)
 	{
-		out[(*olen)++]=b64[in[0]>>2];
-		out[(*olen)++]=b64[((in[0]<<4)&0x3f)|(in[1]>>4)];
-		out[(*olen)++]=b64[((in[1]<<2)&0x3f)|(in[2]>>6)];
-		out[(*olen)++]=b64[in[2]&0x3f];
+		out[0]=b64[in[0]>>2];
+		out[1]=b64[((in[0]<<4)&0x3f)|(in[1]>>4)];
+		out[2]=b64[((in[1]<<2)&0x3f)|(in[2]>>6)];
+		out[3]=b64[in[2]&0x3f];
 	}
+	return i;
+}
+
+static int enc64_tail(unsigned char *in,int ilen,char *out)
+{
 	switch(ilen)
 	{
-	case 1:	out[(*olen)++]=b64[in[0]>>2];
-		out[(*olen)++]=b64[((in[0]<<4)&0x3f)];
-		out[(*olen)++]='=';
-		out[(*olen)++]='=';
-		break;
-	case 2:	out[(*olen)++]=b64[in[0]>>2];
-		out[(*olen)++]=b64[((in[0]<<4)&0x3f)|(in[1]>>4)];
-		out[(*olen)++]=b64[((in[1]<<2)&0x3f)];
-		out[(*olen)++]='=';
-		break;
+	case 1:	out[0]=b64[in[0]>>2];
+		out[1]=b64[((in[0]<<4)&0x3f)];
+		out[2]='=';
+		out[3]='=';
+		return 4;
+	case 2:	out[0]=b64[in[0]>>2];
+		out[1]=b64[((in[0]<<4)&0x3f)|(in[1]>>4)];
+		out[2]=b64[((in[1]<<2)&0x3f)];
+		out[3]='=';
+		return 4;
 	}
+	return 0;
+}
+
+static int dec64_std(char *in,int ilen,unsigned char *out)
+{
+	register int i;
+	register unsigned int a;
+	register unsigned int b;
+	register unsigned int c;
+	register unsigned int d;
+
+	for(i=0;ilen-i>3;i+=4,in+=4,out+=3)
+	{
+		a=unb64[(unsigned char)in[0]];
+		b=unb64[(unsigned char)in[1]];
+		c=unb64[(unsigned char)in[2]];
+		d=unb64[(unsigned char)in[3]];
+		if((a|b|c|d)&0x80)break;
+		out[0]=(unsigned char)((a<<2)|(b>>4));
+		out[1]=(unsigned char)((b<<4)|(c>>2));
+		out[2]=(unsigned char)((c<<6)|d);
+	}
+	return i;
+}
+
+static int dec64_tail(char *in,unsigned char *out)
+{
+	register unsigned int a=unb64[(unsigned char)in[0]];
+	register unsigned int b=unb64[(unsigned char)in[1]];
+	register unsigned int c=unb64[(unsigned char)in[2]];
+	register unsigned int d=unb64[(unsigned char)in[3]];
+
+	if((a|b)&0x80)return -1;
+	out[0]=(unsigned char)((a<<2)|(b>>4));
+	if(in[2]=='='&&in[3]=='=')return 1;
+	if(c&0x80)return -1;
+	out[1]=(unsigned char)((b<<4)|(c>>2));
+	if(in[3]=='=')return 2;
+	if(d&0x80)return -1;
+	out[2]=(unsigned char)((c<<6)|d);
+	return 3;
+}
+
+#ifdef X86
+
+__attribute__((target("avx2"))) static int enc64_avx2(unsigned char *in,
+	int ilen,char *out)
+{
+	register int i;
+	__m256i v;
+	__m256i t;
+	const __m256i shuf=_mm256_setr_epi8(
+		1,0,2,1,4,3,5,4,7,6,8,7,10,9,11,10,
+		1,0,2,1,4,3,5,4,7,6,8,7,10,9,11,10);
+	const __m256i shift=_mm256_setr_epi8(
+		'a'-26,'0'-52,'0'-52,'0'-52,'0'-52,'0'-52,'0'-52,'0'-52,
+		'0'-52,'0'-52,'0'-52,'+'-62,'/'-63,'A',0,0,
+		'a'-26,'0'-52,'0'-52,'0'-52,'0'-52,'0'-52,'0'-52,'0'-52,
+		'0'-52,'0'-52,'0'-52,'+'-62,'/'-63,'A',0,0);
+
+	for(i=0;ilen-i>=28;i+=24,in+=24,out+=32)
+	{
+		v=_mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((__m128i *)in)),
+			_mm_loadu_si128((__m128i *)(in+12)),1);
+		v=_mm256_shuffle_epi8(v,shuf);
+		t=_mm256_mulhi_epu16(_mm256_and_si256(v,
+			_mm256_set1_epi32(0x0fc0fc00)),
+			_mm256_set1_epi32(0x04000040));
+		v=_mm256_mullo_epi16(_mm256_and_si256(v,
+			_mm256_set1_epi32(0x003f03f0)),
+			_mm256_set1_epi32(0x01000010));
+		v=_mm256_or_si256(v,t);
+		t=_mm256_or_si256(_mm256_subs_epu8(v,_mm256_set1_epi8(51)),
+			_mm256_and_si256(_mm256_cmpgt_epi8(
+			_mm256_set1_epi8(26),v),_mm256_set1_epi8(13)));
+		v=_mm256_add_epi8(v,_mm256_shuffle_epi8(shift,t));
+		_mm256_storeu_si256((__m256i *)out,v);
+	}
+	return i+enc64_std(in,ilen-i,out);
+}
+
+__attribute__((target("avx2"))) static int dec64_avx2(char *in,int ilen,
+	unsigned char *out)
+{
+	register int i;
+	__m256i v;
+	__m256i hi;
+	__m256i lo;
+	const __m256i mask=_mm256_set1_epi8(0x2f);
+	const __m256i lutlo=_mm256_setr_epi8(
+		0x15,0x11,0x11,0x11,0x11,0x11,0x11,0x11,
+		0x11,0x11,0x13,0x1a,0x1b,0x1b,0x1b,0x1a,
+		0x15,0x11,0x11,0x11,0x11,0x11,0x11,0x11,
+		0x11,0x11,0x13,0x1a,0x1b,0x1b,0x1b,0x1a);
+	const __m256i luthi=_mm256_setr_epi8(
+		0x10,0x10,0x01,0x02,0x04,0x08,0x04,0x08,
+		0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,
+		0x10,0x10,0x01,0x02,0x04,0x08,0x04,0x08,
+		0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10);
+	const __m256i lutroll=_mm256_setr_epi8(
+		0,16,19,4,-65,-65,-71,-71,0,0,0,0,0,0,0,0,
+		0,16,19,4,-65,-65,-71,-71,0,0,0,0,0,0,0,0);
+	const __m256i pack=_mm256_setr_epi8(
+		2,1,0,6,5,4,10,9,8,14,13,12,-1,-1,-1,-1,
+		2,1,0,6,5,4,10,9,8,14,13,12,-1,-1,-1,-1);
+
+	for(i=0;ilen-i>=32;i+=32,in+=32,out+=24)
+	{
+		v=_mm256_loadu_si256((__m256i *)in);
+		hi=_mm256_and_si256(_mm256_srli_epi32(v,4),mask);
+		lo=_mm256_shuffle_epi8(lutlo,_mm256_and_si256(v,mask));
+		if(!_mm256_testz_si256(lo,_mm256_shuffle_epi8(luthi,hi)))break;
+		v=_mm256_add_epi8(v,_mm256_shuffle_epi8(lutroll,_mm256_add_epi8(
+			_mm256_cmpeq_epi8(v,mask),hi)));
+		v=_mm256_maddubs_epi16(v,_mm256_set1_epi32(0x01400140));
+		v=_mm256_madd_epi16(v,_mm256_set1_epi32(0x00011000));
+		v=_mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v,pack),
+			_mm256_setr_epi32(0,1,2,4,5,6,3,7));
+		_mm_storeu_si128((__m128i *)out,_mm256_castsi256_si128(v));
+		_mm_storel_epi64((__m128i *)(out+16),
+			_mm256_extracti128_si256(v,1));
+	}
+	return i+dec64_std(in,ilen-i,out);
+}
+
+#endif
+
+static int (*enc64)(unsigned char *in,int ilen,char *out)=enc64_std;
+static int (*dec64)(char *in,int ilen,unsigned char *out)=dec64_std;
+
+#ifdef X86
+
+__attribute__((constructor)) static void utilsetup(void)
+{
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+	{
+		nibenc=nibenc_avx2;
+		nibdec=nibdec_avx2;
+		nibscan=nibscan_avx2;
+		enc64=enc64_avx2;
+		dec64=dec64_avx2;
+	}
+}
+
+#endif
+
+int neosc_util_base64_encode(unsigned char *in,int ilen,char *out,int *olen)
+{
+	register int n;
+
+	if(!in||ilen<0||!out||!olen||*olen<(((ilen+2)/3)<<2)+1)return -1;
+
+	n=enc64(in,ilen,out);
+	*olen=(n/3)<<2;
+	*olen+=enc64_tail(in+n,ilen-n,out+*olen);
 	out[*olen]=0;
 	return 0;
 }
 
 int neosc_util_base64_decode(char *in,int ilen,unsigned char *out,int *olen)
 {
-	int i;
-	unsigned char n;
-	unsigned char r=0;
+	int n;
+	int len=ilen;
 
 	if(!in||ilen<0||(ilen&3)||!out||!olen)return -1;
 	if(ilen)
@@ -280,29 +993,99 @@ int neosc_util_base64_decode(char *in,int ilen,unsigned char *out,int *olen)
 	}
 	if(*olen<((ilen&3)?(ilen>>2)*3+(ilen&3)-1:(ilen>>2)*3))return -1;
 
-	for(i=0,*olen=0;ilen--;i=(i+1)&3,in++)
+	n=dec64(in,len,out);
+	*olen=(n>>2)*3;
+	if(n==len)return 0;
+	if(len-n!=4||(n=dec64_tail(in+n,out+*olen))==-1)return -1;
+	*olen+=n;
+	return 0;
+}
+
+void neosc_util_base64_init(NEOSC_BASE64DATA *ptr)
+{
+	ptr->size=0;
+	ptr->done=0;
+}
+
+int neosc_util_base64_encode_next(NEOSC_BASE64DATA *ptr,unsigned char *in,
+	int ilen,char *out,int *olen)
+{
+	register int n;
+
+	if(!ptr||!in||ilen<0||!out||!olen||
+		*olen<((ptr->size+ilen)/3)<<2)return -1;
+
+	for(*olen=0;ptr->size&&ptr->size<3&&ilen;ilen--)
+		ptr->bfr[ptr->size++]=*in++;
+	if(ptr->size==3)
 	{
-		if(*in>='A'&&*in<='Z')n=*in-'A';
-		else if(*in>='a'&&*in<='z')n=*in-'a'+26;
-		else if(*in>='0'&&*in<='9')n=*in-'0'+52;
-		else if(*in=='+')n=62;
-		else if(*in=='/')n=63;
-		else return -1;
+		enc64_std(ptr->bfr,3,out);
+		*olen=4;
+		ptr->size=0;
+	}
+	else if(ptr->size)return 0;
 
-		switch(i)
-		{
-		case 0: out[*olen]=n<<2;
-			break;
-		case 1:	out[(*olen)++]|=n>>4;
-			r=n<<4;
-			break;
-		case 2:	out[(*olen)++]=r|(n>>2);
-			r=n<<6;
-			break;
-		case 3:	out[(*olen)++]=r|n;
-			break;
-		}
+	n=enc64(in,ilen,out+*olen);
+	*olen+=(n/3)<<2;
+	memcpy(ptr->bfr,in+n,ilen-n);
+	ptr->size=(unsigned char)(ilen-n);
+	return 0;
+}
+
+int neosc_util_base64_encode_end(NEOSC_BASE64DATA *ptr,char *out,int *olen)
+{
+	if(!ptr||!out||!olen||*olen<5)return -1;
+
+	*olen=enc64_tail(ptr->bfr,ptr->size,out);
+	out[*olen]=0;
+	ptr->size=0;
+	return 0;
+}
+
+int neosc_util_base64_decode_next(NEOSC_BASE64DATA *ptr,char *in,int ilen,
+	unsigned char *out,int *olen)
+{
+	register int n;
+
+	if(!ptr||!in||ilen<0||!out||!olen||
+		*olen<((ptr->size+ilen)>>2)*3)return -1;
+	if(ptr->done&&ilen)return -1;
+
+	for(*olen=0;ptr->size&&ptr->size<4&&ilen;ilen--)
+		ptr->bfr[ptr->size++]=*in++;
+	if(ptr->size==4)
+	{
+		if((n=dec64_tail((char *)ptr->bfr,out))==-1)return -1;
+		*olen=n;
+		ptr->size=0;
+		if(n<3)goto done;
 	}
+	else if(ptr->size)return 0;
+
+	n=dec64(in,ilen,out+*olen);
+	*olen+=(n>>2)*3;
+	in+=n;
+	ilen-=n;
+	if(ilen>3)
+	{
+		if((n=dec64_tail(in,out+*olen))==-1)return -1;
+		*olen+=n;
+		in+=4;
+		ilen-=4;
+		if(n<3)goto done;
+	}
+	memcpy(ptr->bfr,in,ilen);
+	ptr->size=(unsigned char)ilen;
+	return 0;
+
+done:	ptr->done=1;
+	return ilen?-1:0;
+}
+
+int neosc_util_base64_decode_end(NEOSC_BASE64DATA *ptr)
+{
+	if(!ptr||ptr->size)return -1;
+	ptr->done=0;
 	return 0;
 }
 
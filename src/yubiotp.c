@@ -0,0 +1,469 @@
+/* 
+ * libneosc - an easy access library to the YubiKey NEO(-N)/4 (nano)
+ *
+ * Copyright (c) 2015 Andreas Steinmetz, ast@domdv.de
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301  USA
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <wmmintrin.h>
+#define AESNI
+#endif
+#include "libneosc.h"
+
+#define memclear(a,b,c) \
+    do { memset(a,b,c); *(volatile char*)(a)=*(volatile char*)(a); } while(0)
+
+#define rotl(a,n) (((a)<<(n))|((a)>>(32-(n))))
+
+typedef struct
+{
+	int used;
+	int publen;
+	int counter;
+	unsigned char pubid[16];
+	unsigned char privid[6];
+	unsigned char dk[176];
+} ENTRY;
+
+typedef struct
+{
+	pthread_rwlock_t lck;
+	int size;
+	int total;
+	ENTRY *tab;
+	void *mem;
+	void *store;
+} CTX;
+
+static unsigned char sbox[256]=
+{
+	0x63,0x7c,0x77,0x7b,0xf2,0x6b,0x6f,0xc5,0x30,0x01,0x67,0x2b,
+	0xfe,0xd7,0xab,0x76,0xca,0x82,0xc9,0x7d,0xfa,0x59,0x47,0xf0,
+	0xad,0xd4,0xa2,0xaf,0x9c,0xa4,0x72,0xc0,0xb7,0xfd,0x93,0x26,
+	0x36,0x3f,0xf7,0xcc,0x34,0xa5,0xe5,0xf1,0x71,0xd8,0x31,0x15,
+	0x04,0xc7,0x23,0xc3,0x18,0x96,0x05,0x9a,0x07,0x12,0x80,0xe2,
+	0xeb,0x27,0xb2,0x75,0x09,0x83,0x2c,0x1a,0x1b,0x6e,0x5a,0xa0,
+	0x52,0x3b,0xd6,0xb3,0x29,0xe3,0x2f,0x84,0x53,0xd1,0x00,0xed,
+	0x20,0xfc,0xb1,0x5b,0x6a,0xcb,0xbe,0x39,0x4a,0x4c,0x58,0xcf,
+	0xd0,0xef,0xaa,0xfb,0x43,0x4d,0x33,0x85,0x45,0xf9,0x02,0x7f,
+	0x50,0x3c,0x9f,0xa8,0x51,0xa3,0x40,0x8f,0x92,0x9d,0x38,0xf5,
+	0xbc,0xb6,0xda,0x21,0x10,0xff,0xf3,0xd2,0xcd,0x0c,0x13,0xec,
+	0x5f,0x97,0x44,0x17,0xc4,0xa7,0x7e,0x3d,0x64,0x5d,0x19,0x73,
+	0x60,0x81,0x4f,0xdc,0x22,0x2a,0x90,0x88,0x46,0xee,0xb8,0x14,
+	0xde,0x5e,0x0b,0xdb,0xe0,0x32,0x3a,0x0a,0x49,0x06,0x24,0x5c,
+	0xc2,0xd3,0xac,0x62,0x91,0x95,0xe4,0x79,0xe7,0xc8,0x37,0x6d,
+	0x8d,0xd5,0x4e,0xa9,0x6c,0x56,0xf4,0xea,0x65,0x7a,0xae,0x08,
+	0xba,0x78,0x25,0x2e,0x1c,0xa6,0xb4,0xc6,0xe8,0xdd,0x74,0x1f,
+	0x4b,0xbd,0x8b,0x8a,0x70,0x3e,0xb5,0x66,0x48,0x03,0xf6,0x0e,
+	0x61,0x35,0x57,0xb9,0x86,0xc1,0x1d,0x9e,0xe1,0xf8,0x98,0x11,
+	0x69,0xd9,0x8e,0x94,0x9b,0x1e,0x87,0xe9,0xce,0x55,0x28,0xdf,
+	0x8c,0xa1,0x89,0x0d,0xbf,0xe6,0x42,0x68,0x41,0x99,0x2d,0x0f,
+	0xb0,0x54,0xbb,0x16
+};
+
+static unsigned char isbox[256]=
+{
+	0x52,0x09,0x6a,0xd5,0x30,0x36,0xa5,0x38,0xbf,0x40,0xa3,0x9e,
+	0x81,0xf3,0xd7,0xfb,0x7c,0xe3,0x39,0x82,0x9b,0x2f,0xff,0x87,
+	0x34,0x8e,0x43,0x44,0xc4,0xde,0xe9,0xcb,0x54,0x7b,0x94,0x32,
+	0xa6,0xc2,0x23,0x3d,0xee,0x4c,0x95,0x0b,0x42,0xfa,0xc3,0x4e,
+	0x08,0x2e,0xa1,0x66,0x28,0xd9,0x24,0xb2,0x76,0x5b,0xa2,0x49,
+	0x6d,0x8b,0xd1,0x25,0x72,0xf8,0xf6,0x64,0x86,0x68,0x98,0x16,
+	0xd4,0xa4,0x5c,0xcc,0x5d,0x65,0xb6,0x92,0x6c,0x70,0x48,0x50,
+	0xfd,0xed,0xb9,0xda,0x5e,0x15,0x46,0x57,0xa7,0x8d,0x9d,0x84,
+	0x90,0xd8,0xab,0x00,0x8c,0xbc,0xd3,0x0a,0xf7,0xe4,0x58,0x05,
+	0xb8,0xb3,0x45,0x06,0xd0,0x2c,0x1e,0x8f,0xca,0x3f,0x0f,0x02,
+	0xc1,0xaf,0xbd,0x03,0x01,0x13,0x8a,0x6b,0x3a,0x91,0x11,0x41,
+	0x4f,0x67,0xdc,0xea,0x97,0xf2,0xcf,0xce,0xf0,0xb4,0xe6,0x73,
+	0x96,0xac,0x74,0x22,0xe7,0xad,0x35,0x85,0xe2,0xf9,0x37,0xe8,
+	0x1c,0x75,0xdf,0x6e,0x47,0xf1,0x1a,0x71,0x1d,0x29,0xc5,0x89,
+	0x6f,0xb7,0x62,0x0e,0xaa,0x18,0xbe,0x1b,0xfc,0x56,0x3e,0x4b,
+	0xc6,0xd2,0x79,0x20,0x9a,0xdb,0xc0,0xfe,0x78,0xcd,0x5a,0xf4,
+	0x1f,0xdd,0xa8,0x33,0x88,0x07,0xc7,0x31,0xb1,0x12,0x10,0x59,
+	0x27,0x80,0xec,0x5f,0x60,0x51,0x7f,0xa9,0x19,0xb5,0x4a,0x0d,
+	0x2d,0xe5,0x7a,0x9f,0x93,0xc9,0x9c,0xef,0xa0,0xe0,0x3b,0x4d,
+	0xae,0x2a,0xf5,0xb0,0xc8,0xeb,0xbb,0x3c,0x83,0x53,0x99,0x61,
+	0x17,0x2b,0x04,0x7e,0xba,0x77,0xd6,0x26,0xe1,0x69,0x14,0x63,
+	0x55,0x21,0x0c,0x7d
+};
+
+static unsigned int td[256];
+static int aesni;
+static pthread_once_t once=PTHREAD_ONCE_INIT;
+
+static unsigned char xtime(unsigned char a)
+{
+	return (unsigned char)((a<<1)^(a&0x80?0x1b:0x00));
+}
+
+static void setup(void)
+{
+	int i;
+	unsigned char s;
+	unsigned char s2;
+	unsigned char s4;
+	unsigned char s8;
+
+	for(i=0;i<256;i++)
+	{
+		s=isbox[i];
+		s2=xtime(s);
+		s4=xtime(s2);
+		s8=xtime(s4);
+		td[i]=(unsigned int)(s8^s4^s2)|((unsigned int)(s8^s)<<8)|
+			((unsigned int)(s8^s4^s)<<16)|
+			((unsigned int)(s8^s2^s)<<24);
+	}
+#ifdef AESNI
+	__builtin_cpu_init();
+	aesni=__builtin_cpu_supports("aes");
+#endif
+}
+
+static unsigned int imc(unsigned char *k)
+{
+	return td[sbox[k[0]]]^rotl(td[sbox[k[1]]],8)^
+		rotl(td[sbox[k[2]]],16)^rotl(td[sbox[k[3]]],24);
+}
+
+static void aes_setkey(unsigned char *key,unsigned char *dk)
+{
+	int i;
+	int j;
+	unsigned int w;
+	unsigned char rcon=0x01;
+	unsigned char ek[176];
+
+	memcpy(ek,key,16);
+	for(i=16;i<176;i+=4)
+	{
+		if(!(i&15))
+		{
+			ek[i]=ek[i-16]^sbox[ek[i-3]]^rcon;
+			ek[i+1]=ek[i-15]^sbox[ek[i-2]];
+			ek[i+2]=ek[i-14]^sbox[ek[i-1]];
+			ek[i+3]=ek[i-13]^sbox[ek[i-4]];
+			rcon=xtime(rcon);
+		}
+		else for(j=0;j<4;j++)ek[i+j]=ek[i+j-16]^ek[i+j-4];
+	}
+
+	memcpy(dk,ek+160,16);
+	for(i=1;i<10;i++)for(j=0;j<16;j+=4)
+	{
+		w=imc(ek+160-16*i+j);
+		dk[16*i+j]=(unsigned char)w;
+		dk[16*i+j+1]=(unsigned char)(w>>8);
+		dk[16*i+j+2]=(unsigned char)(w>>16);
+		dk[16*i+j+3]=(unsigned char)(w>>24);
+	}
+	memcpy(dk+160,ek,16);
+
+	memclear(ek,0,sizeof(ek));
+}
+
+#ifdef AESNI
+
+__attribute__((target("sse2,aes")))
+static void aes_decrypt_ni(unsigned char *dk,unsigned char *in,
+	unsigned char *out)
+{
+	int i;
+	__m128i s;
+
+	s=_mm_xor_si128(_mm_loadu_si128((__m128i *)in),
+		_mm_loadu_si128((__m128i *)dk));
+	for(i=16;i<160;i+=16)
+		s=_mm_aesdec_si128(s,_mm_loadu_si128((__m128i *)(dk+i)));
+	s=_mm_aesdeclast_si128(s,_mm_loadu_si128((__m128i *)(dk+160)));
+	_mm_storeu_si128((__m128i *)out,s);
+}
+
+#endif
+
+static void aes_decrypt(unsigned char *dk,unsigned char *in,unsigned char *out)
+{
+	int i;
+	int j;
+	unsigned int w[4];
+	unsigned char s[16];
+
+#ifdef AESNI
+	if(aesni)
+	{
+		aes_decrypt_ni(dk,in,out);
+		return;
+	}
+#endif
+	for(i=0;i<16;i++)s[i]=in[i]^dk[i];
+
+	for(i=16;i<160;i+=16)
+	{
+		for(j=0;j<4;j++)w[j]=td[s[4*j]]^rotl(td[s[(4*j+13)&15]],8)^
+			rotl(td[s[(4*j+10)&15]],16)^
+			rotl(td[s[(4*j+7)&15]],24);
+		for(j=0;j<16;j+=4)
+		{
+			s[j]=(unsigned char)w[j>>2]^dk[i+j];
+			s[j+1]=(unsigned char)(w[j>>2]>>8)^dk[i+j+1];
+			s[j+2]=(unsigned char)(w[j>>2]>>16)^dk[i+j+2];
+			s[j+3]=(unsigned char)(w[j>>2]>>24)^dk[i+j+3];
+		}
+	}
+
+	for(j=0;j<16;j+=4)
+	{
+		out[j]=isbox[s[j]]^dk[160+j];
+		out[j+1]=isbox[s[(j+13)&15]]^dk[161+j];
+		out[j+2]=isbox[s[(j+10)&15]]^dk[162+j];
+		out[j+3]=isbox[s[(j+7)&15]]^dk[163+j];
+	}
+
+	memclear(s,0,sizeof(s));
+	memclear(w,0,sizeof(w));
+}
+
+static unsigned short crc16(unsigned char *ptr,int len)
+{
+	int i;
+	unsigned short crc=0xffff;
+
+	while(len--)
+	{
+		crc^=*ptr++;
+		for(i=0;i<8;i++)if(crc&1)crc=(crc>>1)^0x8408;
+		else crc>>=1;
+	}
+	return crc;
+}
+
+static unsigned int hash(unsigned char *pubid,int publen)
+{
+	unsigned int h=0x811c9dc5;
+
+	while(publen--)h=(h^*pubid++)*0x01000193;
+	return h;
+}
+
+static ENTRY *lookup(CTX *ctx,unsigned char *pubid,int publen)
+{
+	unsigned int i;
+	unsigned int mask=ctx->size-1;
+
+	for(i=hash(pubid,publen)&mask;ctx->tab[i].used;i=(i+1)&mask)
+		if(ctx->tab[i].publen==publen&&
+			!memcmp(ctx->tab[i].pubid,pubid,publen))
+			return &ctx->tab[i];
+	return NULL;
+}
+
+static int grow(CTX *ctx)
+{
+	int i;
+	int size;
+	unsigned int j;
+	ENTRY *tab;
+
+	size=ctx->size<<1;
+	if(!(tab=calloc(size,sizeof(ENTRY))))return -1;
+
+	for(i=0;i<ctx->size;i++)if(ctx->tab[i].used)
+	{
+		for(j=hash(ctx->tab[i].pubid,ctx->tab[i].publen)&(size-1);
+			tab[j].used;j=(j+1)&(size-1));
+		tab[j]=ctx->tab[i];
+	}
+
+	memclear(ctx->tab,0,ctx->size*sizeof(ENTRY));
+	free(ctx->tab);
+	ctx->tab=tab;
+	ctx->size=size;
+	return 0;
+}
+
+static int decode(char *otp,int olen,unsigned char *pubid,int *publen,
+	unsigned char *token)
+{
+	int len;
+
+	if(!otp||olen<32||olen>64||(olen&1))return -1;
+
+	*publen=16;
+	if(neosc_util_modhex_decode(otp,olen-32,pubid,publen))return -1;
+	len=16;
+	if(neosc_util_modhex_decode(otp+olen-32,32,token,&len))return -1;
+	return 0;
+}
+
+static int parse(unsigned char *dk,unsigned char *token,
+	NEOSC_YUBIOTP_TOKEN *data)
+{
+	int r=-1;
+	unsigned char bfr[16];
+
+	aes_decrypt(dk,token,bfr);
+	if(crc16(bfr,16)!=0xf0b8)goto out;
+
+	memcpy(data->privid,bfr,6);
+	data->usectr=bfr[6]|(bfr[7]<<8);
+	data->tstamp=bfr[8]|(bfr[9]<<8)|(bfr[10]<<16);
+	data->sessctr=bfr[11];
+	data->random=bfr[12]|(bfr[13]<<8);
+	r=0;
+
+out:	memclear(bfr,0,sizeof(bfr));
+	return r;
+}
+
+int neosc_yubiotp_decode(char *otp,int olen,unsigned char *aeskey,
+	NEOSC_YUBIOTP_TOKEN *token)
+{
+	int r=-1;
+	unsigned char dk[176];
+	unsigned char bfr[16];
+
+	if(!aeskey||!token)return -1;
+	pthread_once(&once,setup);
+
+	if(decode(otp,olen,token->pubid,&token->publen,bfr))goto out;
+	aes_setkey(aeskey,dk);
+	r=parse(dk,bfr,token);
+
+out:	memclear(dk,0,sizeof(dk));
+	memclear(bfr,0,sizeof(bfr));
+	return r;
+}
+
+int neosc_yubiotp_open(void **handle)
+{
+	CTX *ctx;
+
+	if(!handle)return -1;
+	pthread_once(&once,setup);
+
+	if(!(ctx=malloc(sizeof(CTX))))return -1;
+	ctx->size=64;
+	ctx->total=0;
+	if(!(ctx->tab=calloc(ctx->size,sizeof(ENTRY))))goto err1;
+	if(neosc_store_open(NULL,64,0,&ctx->mem))goto err2;
+	if(pthread_rwlock_init(&ctx->lck,NULL))goto err3;
+	ctx->store=ctx->mem;
+	*handle=ctx;
+	return 0;
+
+err3:	neosc_store_close(ctx->mem);
+err2:	free(ctx->tab);
+err1:	free(ctx);
+	return -1;
+}
+
+int neosc_yubiotp_add(void *handle,NEOSC_YUBIOTP_CRED *cred)
+{
+	int r=-1;
+	CTX *ctx=handle;
+	ENTRY *e;
+
+	if(!ctx||!cred||cred->publen<0||cred->publen>16||cred->usectr<-1||
+		cred->usectr>0xffff||cred->sessctr<-1||cred->sessctr>0xff||
+		(cred->usectr==-1)!=(cred->sessctr==-1))return -1;
+
+	pthread_rwlock_wrlock(&ctx->lck);
+	if(!(e=lookup(ctx,cred->pubid,cred->publen)))
+	{
+		if((ctx->total+1)<<1>ctx->size&&grow(ctx))goto out;
+		for(e=&ctx->tab[hash(cred->pubid,cred->publen)&(ctx->size-1)];
+			e->used;e=(e==&ctx->tab[ctx->size-1]?ctx->tab:e+1));
+		e->used=1;
+		e->publen=cred->publen;
+		memcpy(e->pubid,cred->pubid,cred->publen);
+		ctx->total++;
+	}
+	memcpy(e->privid,cred->privid,6);
+	aes_setkey(cred->aeskey,e->dk);
+	e->counter=cred->usectr==-1?-1:
+		((cred->usectr&0x7fff)<<8)|cred->sessctr;
+	r=0;
+
+out:	pthread_rwlock_unlock(&ctx->lck);
+	return r;
+}
+
+int neosc_yubiotp_verify(void *handle,char *otp,int olen,
+	NEOSC_YUBIOTP_TOKEN *token)
+{
+	int r=-1;
+	int counter;
+	CTX *ctx=handle;
+	ENTRY *e;
+	unsigned char bfr[17];
+
+	if(!ctx||!token)return -1;
+	if(decode(otp,olen,token->pubid,&token->publen,bfr))goto out;
+
+	pthread_rwlock_rdlock(&ctx->lck);
+	if(!(e=lookup(ctx,token->pubid,token->publen)))goto unlock;
+	if(parse(e->dk,bfr,token))goto unlock;
+	if(memcmp(e->privid,token->privid,6))goto unlock;
+	counter=((token->usectr&0x7fff)<<8)|token->sessctr;
+	if(counter<=e->counter)
+	{
+		r=NEOSC_YUBIOTP_REPLAY;
+		goto unlock;
+	}
+	bfr[0]='Y';
+	memcpy(bfr+1,token->pubid,token->publen);
+	switch(neosc_store_advance(ctx->store,bfr,token->publen+1,counter))
+	{
+	case 0:	r=0;
+		break;
+	case NEOSC_STORE_REPLAY:
+		r=NEOSC_YUBIOTP_REPLAY;
+		break;
+	}
+
+unlock:	pthread_rwlock_unlock(&ctx->lck);
+out:	memclear(bfr,0,sizeof(bfr));
+	return r;
+}
+
+int neosc_yubiotp_store(void *handle,void *store)
+{
+	CTX *ctx=handle;
+
+	if(!ctx)return -1;
+
+	pthread_rwlock_wrlock(&ctx->lck);
+	ctx->store=store?store:ctx->mem;
+	pthread_rwlock_unlock(&ctx->lck);
+	return 0;
+}
+
+void neosc_yubiotp_close(void *handle)
+{
+	CTX *ctx=handle;
+
+	if(!ctx)return;
+	pthread_rwlock_destroy(&ctx->lck);
+	neosc_store_close(ctx->mem);
+	memclear(ctx->tab,0,ctx->size*sizeof(ENTRY));
+	free(ctx->tab);
+	free(ctx);
+}